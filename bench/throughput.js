@@ -0,0 +1,160 @@
+// Event path benchmark, run against the simulated devices:
+//
+//   node-gyp rebuild -- -Dphidget_simulator=1
+//   node bench/throughput.js --devices=8 --interval-us=1000 --mode=batch
+//
+// Reports sustained samples per second, latency from sample generation on
+// the device thread until it is seen by JavaScript, and process CPU time
+// per sample. Modes are "data" (one event per sample), "batch" (dataBatch
+// events) and "buffer" (polling the shared sample buffer).
+
+var options = {
+  "devices": 4,
+  "inputs": 4,
+  "interval-us": 1000,
+  "duration": 10,
+  "warmup": 2,
+  "poll-ms": 10,
+  "mode": "data"
+};
+
+process.argv.slice(2).forEach(function(arg) {
+  var match = /^--([^=]+)=(.*)$/.exec(arg);
+
+  if (!match || !(match[1] in options)) {
+    console.error("Unknown argument " + arg);
+    process.exit(1);
+  }
+
+  options[match[1]] = typeof options[match[1]] === "number" ? Number(match[2]) : match[2];
+});
+
+process.env.PHIDGET_SIM_DEVICES = options.devices;
+process.env.PHIDGET_SIM_INPUTS = options.inputs;
+process.env.PHIDGET_SIM_INTERVAL_US = options["interval-us"];
+process.env.PHIDGET_SIM_ATTACH_MS = 10;
+process.env.PHIDGET_SIM_SIGNAL = "clock";
+
+var phidget = require("../lib/index.js");
+
+var MAX_LATENCIES = 1000000;
+var latencies = new Float64Array(MAX_LATENCIES);
+var latencyCount = 0;
+var samples = 0;
+var measuring = false;
+var handles = [];
+var attached = 0;
+var startTime, startCpu, startDropped;
+
+var now = function() {
+  var time = process.hrtime();
+  return time[0] * 1e3 + time[1] / 1e6;
+};
+
+var cpuTime = function() {
+  if (!process.cpuUsage) {
+    return NaN;
+  }
+
+  var usage = process.cpuUsage();
+  return (usage.user + usage.system) / 1e3;
+};
+
+var record = function(value, time) {
+  if (!measuring) {
+    return;
+  }
+
+  samples++;
+
+  if (latencyCount < MAX_LATENCIES) {
+    latencies[latencyCount++] = time - value;
+  }
+};
+
+var percentile = function(sorted, fraction) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * fraction))];
+};
+
+var report = function() {
+  var elapsed = (now() - startTime) / 1e3;
+  var cpu = cpuTime() - startCpu;
+  var sorted = Array.prototype.slice.call(latencies, 0, latencyCount).sort(function(a, b) { return a - b; });
+
+  measuring = false;
+
+  console.log("mode:              " + options.mode);
+  console.log("devices x inputs:  " + options.devices + " x " + options.inputs + " @ " + options["interval-us"] + " us");
+  console.log("samples:           " + samples);
+  console.log("samples/s:         " + (samples / elapsed).toFixed(0));
+  console.log("dropped:           " + (phidget.getDroppedEvents() - startDropped));
+  console.log("latency p50 ms:    " + percentile(sorted, 0.5).toFixed(3));
+  console.log("latency p90 ms:    " + percentile(sorted, 0.9).toFixed(3));
+  console.log("latency p99 ms:    " + percentile(sorted, 0.99).toFixed(3));
+  console.log("latency p99.9 ms:  " + percentile(sorted, 0.999).toFixed(3));
+  console.log("latency max ms:    " + sorted[sorted.length - 1].toFixed(3));
+  console.log("cpu us/sample:     " + (cpu * 1e3 / samples).toFixed(3));
+
+  handles.forEach(function(handle) {
+    phidget.remove(handle);
+  });
+
+  process.exit(0);
+};
+
+var start = function() {
+  setTimeout(function() {
+    startTime = now();
+    startCpu = cpuTime();
+    startDropped = phidget.getDroppedEvents();
+    measuring = true;
+
+    setTimeout(report, options.duration * 1000);
+  }, options.warmup * 1000);
+};
+
+if (options.mode === "data") {
+  phidget.on("data", function(handle, index, value) {
+    record(value, now());
+  });
+} else if (options.mode === "batch") {
+  phidget.setBatchMode(true);
+
+  phidget.on("dataBatch", function(handles, indices, values, timestamps) {
+    var time = now();
+
+    for (var n = 0; n < values.length; n++) {
+      record(values[n], time);
+    }
+  });
+} else if (options.mode === "buffer") {
+  var reader = phidget.createSampleReader(1 << 20);
+
+  setInterval(function() {
+    var time = now();
+
+    reader.read(function(handle, index, value, timestamp) {
+      record(value, time);
+    });
+  }, options["poll-ms"]);
+} else {
+  console.error("Unknown mode " + options.mode);
+  process.exit(1);
+}
+
+phidget.on("attach", function(handle) {
+  for (var index = 0; index < options.inputs; index++) {
+    phidget.setEnabled(handle, index, 1);
+  }
+
+  if (++attached === options.devices) {
+    start();
+  }
+});
+
+for (var n = 0; n < options.devices; n++) {
+  var handle = phidget.create();
+
+  handles.push(handle);
+  phidget.open(handle, -1);
+}
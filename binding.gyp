@@ -1,10 +1,21 @@
 {
+  "variables": {
+    # Build against the simulated devices in src/simulator instead of
+    # libphidget21, enable with: node-gyp rebuild -- -Dphidget_simulator=1
+    "phidget_simulator%": 0,
+    # USDT probes for perf and bpftrace, see src/trace.h, enable with:
+    # node-gyp rebuild -- -Dphidget_tracing=1
+    "phidget_tracing%": 0
+  },
   "targets": [
     {
       "target_name": "binding",
       "sources": [
         "src/bridge.cc"
       ],
+      "cflags_cc": [
+        "-std=c++11"
+      ],
       "conditions": [
         ["OS=='mac'",
           {
@@ -12,12 +23,10 @@
               "__MACOSX_CORE__"
             ],
             "xcode_settings": {
-              "GCC_ENABLE_CPP_EXCEPTIONS": "YES"
-            },
-            "link_settings": {
-              "libraries": [
-                "Phidget21.framework"
-              ]
+              "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+              "CLANG_CXX_LANGUAGE_STANDARD": "c++11",
+              "CLANG_CXX_LIBRARY": "libc++",
+              "MACOSX_DEPLOYMENT_TARGET": "10.7"
             }
           }
         ],
@@ -25,24 +34,62 @@
           {
             "defines": [
               "__WINDOWS_MM__"
-            ],
-            "link_settings": {
-              "libraries": [
-                "phidget21.lib"
-              ]
-            }
+            ]
           }
         ],
         ["OS=='linux'",
           {
             "defines": [
               "__LINUX__"
+            ]
+          }
+        ],
+        ["phidget_tracing==1",
+          {
+            "defines": [
+              "PHIDGET_TRACING"
+            ]
+          }
+        ],
+        ["phidget_simulator==1",
+          {
+            "sources": [
+              "src/simulator/simulator.cc"
             ],
-            "link_settings": {
-              "libraries": [
-                "/usr/lib/libphidget21.so"
+            "include_dirs": [
+              "src/simulator"
+            ]
+          },
+          {
+            "conditions": [
+              ["OS=='mac'",
+                {
+                  "link_settings": {
+                    "libraries": [
+                      "Phidget21.framework"
+                    ]
+                  }
+                }
+              ],
+              ["OS=='win'",
+                {
+                  "link_settings": {
+                    "libraries": [
+                      "phidget21.lib"
+                    ]
+                  }
+                }
+              ],
+              ["OS=='linux'",
+                {
+                  "link_settings": {
+                    "libraries": [
+                      "/usr/lib/libphidget21.so"
+                    ]
+                  }
+                }
               ]
-            }
+            ]
           }
         ]
       ]
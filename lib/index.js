@@ -2,13 +2,422 @@
 var binding = require('../build/Release/binding');
 var util = require('util');
 var EventEmitter = require('events').EventEmitter;
+var Readable = require('stream').Readable;
+
+// Bytes per sample of a binary sample stream: double timestamp, uint8 index,
+// double value, little endian
+var SAMPLE_RECORD_SIZE = 17;
+
+// Reads records appended by the addon to the shared sample buffer. Each
+// record is [sequence, handle, index, value, timestamp], sequence being the
+// record number + 1 once the record is completely written.
+var SampleReader = function(buffer) {
+  var header = buffer.header;
+  var records = buffer.records;
+  var capacity = buffer.capacity;
+  var size = buffer.recordSize;
+  var next = header[0];
+
+  this.lost = 0;
+
+  this.read = function(callback) {
+    var head = header[0];
+    var count = 0;
+
+    if (head - next > capacity) {
+      this.lost += head - next - capacity;
+      next = head - capacity;
+    }
+
+    while (next < head) {
+      var offset = (next % capacity) * size;
+      var sequence = records[offset];
+
+      if (sequence < next + 1) {
+        break;
+      }
+
+      var handle = records[offset + 1];
+      var index = records[offset + 2];
+      var value = records[offset + 3];
+      var timestamp = records[offset + 4];
+
+      if (sequence !== next + 1 || records[offset] !== sequence) {
+        this.lost++;
+      } else {
+        callback(handle, index, value, timestamp);
+        count++;
+      }
+
+      next++;
+    }
+
+    return count;
+  };
+};
+
+// Runs an asynchronous binding call. Without a callback a Promise is
+// returned instead, provided the runtime has them.
+var callAsync = function(method, args, callback) {
+  if (typeof callback === "function" || typeof Promise !== "function") {
+    return method.apply(binding, args.concat(callback));
+  }
+
+  return new Promise(function(resolve, reject) {
+    method.apply(binding, args.concat(function(error, result) {
+      if (error) {
+        reject(error);
+      } else {
+        resolve(result);
+      }
+    }));
+  });
+};
+
+// The samples of one handle as a Readable stream, objects in objectMode and
+// binary records otherwise, one Buffer per drain. When the consumer falls
+// behind the addon holds the samples of the handle back instead, keeping at
+// most highWaterMark of them, and the queue policy decides about the rest.
+var SampleStream = function(phidget, handle, options) {
+  var self = this;
+  var objectMode = !!options.objectMode;
+  var depth = options.highWaterMark || 1024;
+  var records = [];
+  var paused = false;
+
+  Readable.call(this, { objectMode: objectMode, highWaterMark: objectMode ? depth : depth * SAMPLE_RECORD_SIZE });
+
+  var deliver = function(chunk) {
+    if (!self.push(chunk) && !paused) {
+      paused = true;
+      binding.pauseDevice(handle, depth);
+    }
+  };
+
+  var addSample = function(index, value, timestamp) {
+    if (objectMode) {
+      deliver({ index: index, value: value, timestamp: timestamp });
+    } else {
+      records.push(index, value, timestamp);
+    }
+  };
+
+  var addFrame = function(timestamp, mask, values) {
+    if (objectMode) {
+      deliver({ timestamp: timestamp, mask: mask, values: values });
+      return;
+    }
+
+    for (var n = 0; n < values.length; n++) {
+      if (mask & (1 << n)) {
+        records.push(n, values[n], timestamp);
+      }
+    }
+  };
+
+  var onData = function(phid, index, value, timestamp) {
+    if (phid === handle) {
+      addSample(index, value, timestamp);
+    }
+  };
+
+  var onDataBatch = function(handles, indices, values, timestamps) {
+    for (var n = 0; n < values.length; n++) {
+      if (handles[n] === handle) {
+        addSample(indices[n], values[n], timestamps[n]);
+      }
+    }
+  };
+
+  var onFrame = function(phid, timestamp, mask, values) {
+    if (phid === handle) {
+      addFrame(timestamp, mask, values);
+    }
+  };
+
+  var onFrameBatch = function(phid, timestamps, masks, values) {
+    var width = values.length / timestamps.length;
+
+    if (phid === handle) {
+      for (var n = 0; n < timestamps.length; n++) {
+        addFrame(timestamps[n], masks[n], values.subarray(n * width, (n + 1) * width));
+      }
+    }
+  };
+
+  var onDrain = function() {
+    if (records.length === 0) {
+      return;
+    }
+
+    var buffer = new Buffer(records.length / 3 * SAMPLE_RECORD_SIZE);
+
+    for (var n = 0, offset = 0; n < records.length; n += 3, offset += SAMPLE_RECORD_SIZE) {
+      buffer.writeDoubleLE(records[n + 2], offset);
+      buffer.writeUInt8(records[n], offset + 8);
+      buffer.writeDoubleLE(records[n + 1], offset + 9);
+    }
+
+    records = [];
+    deliver(buffer);
+  };
+
+  this._read = function() {
+    if (paused) {
+      paused = false;
+      binding.resumeDevice(handle);
+    }
+  };
+
+  this.close = function() {
+    phidget.removeListener("data", onData);
+    phidget.removeListener("dataBatch", onDataBatch);
+    phidget.removeListener("frame", onFrame);
+    phidget.removeListener("frameBatch", onFrameBatch);
+    phidget.removeListener("drain", onDrain);
+
+    onDrain();
+    this._read();
+    this.push(null);
+  };
+
+  phidget.on("data", onData);
+  phidget.on("dataBatch", onDataBatch);
+  phidget.on("frame", onFrame);
+  phidget.on("frameBatch", onFrameBatch);
+  phidget.on("drain", onDrain);
+};
+
+util.inherits(SampleStream, Readable);
+
+// Serial numbers the application opened itself, the device manager leaves
+// those bridges alone
+var openedSerials = {};
+
+var forgetHandle = function(handle) {
+  for (var serial in openedSerials) {
+    if (openedSerials[serial] === handle) {
+      delete openedSerials[serial];
+    }
+  }
+};
+
+// Opens every bridge the library reports as plugged in, unless the
+// application opened it already, and applies the configure() options
+// stored for its serial number, or the default ones, each time it
+// attaches. Bridges found within discoveryMs after start form
+// the initial fleet, "ready" is emitted once all of them are configured or
+// failed. Handles stay open when a bridge is unplugged, so the library
+// attaches them again when it comes back. The asynchronous calls of each
+// handle are counted, close() waits for them before closing and removing
+// it.
+var DeviceManager = function(phidget, options) {
+  var self = this;
+  var configs = options.config || {};
+  var devices = {};
+  var pending = null;
+  var initial = [];
+  var timer = null;
+  var closed = false;
+
+  EventEmitter.call(this);
+
+  // Wraps the callback of an asynchronous call of the device's handle
+  var track = function(device, callback) {
+    device.jobs++;
+
+    return function() {
+      device.jobs--;
+
+      if (!closed) {
+        callback.apply(null, arguments);
+      }
+
+      if (device.jobs === 0 && device.idle) {
+        device.idle();
+      }
+    };
+  };
+
+  var configFor = function(serial) {
+    return configs[serial] || configs["default"] || {};
+  };
+
+  var checkReady = function() {
+    if (pending === null || timer !== null) {
+      return;
+    }
+
+    for (var n = 0; n < initial.length; n++) {
+      if (!initial[n].configured) {
+        return;
+      }
+    }
+
+    pending = null;
+    self.emit("ready", initial.map(function(device) {
+      return { serial: device.serial, handle: device.handle, error: device.error };
+    }));
+  };
+
+  var onFound = function(serial) {
+    if (devices[serial] || serial in openedSerials) {
+      return;
+    }
+
+    var device = devices[serial] = { serial: serial, handle: phidget.create(), configured: false, error: null, jobs: 0, idle: null };
+
+    if (timer !== null) {
+      initial.push(device);
+    }
+
+    // Opening only registers the serial number, every bridge attaches on
+    // its own, so a slow one does not hold up the others
+    callAsync(binding.openAsync, [device.handle, serial], track(device, function(error) {
+      if (error) {
+        device.configured = true;
+        device.error = error;
+        self.emit("deviceError", serial, device.handle, error);
+        checkReady();
+      }
+    }));
+  };
+
+  var onLost = function(serial) {
+    if (devices[serial]) {
+      self.emit("deviceLost", serial, devices[serial].handle);
+    }
+  };
+
+  var onAttach = function(handle) {
+    var device = null;
+
+    for (var serial in devices) {
+      if (devices[serial].handle === handle) {
+        device = devices[serial];
+      }
+    }
+
+    if (device === null) {
+      return;
+    }
+
+    phidget.configure(handle, configFor(device.serial), track(device, function(error, results) {
+      device.configured = true;
+      device.error = error || null;
+
+      if (error) {
+        self.emit("deviceError", device.serial, handle, error);
+      } else {
+        self.emit("deviceReady", device.serial, handle, results);
+      }
+
+      checkReady();
+    }));
+  };
+
+  this.start = function() {
+    closed = false;
+    pending = true;
+    timer = setTimeout(function() {
+      timer = null;
+      checkReady();
+    }, options.discoveryMs || 500);
+
+    phidget.on("managerAttach", onFound);
+    phidget.on("managerDetach", onLost);
+    phidget.on("attach", onAttach);
+    binding.openManager();
+  };
+
+  // Calls back with the first error once every handle is closed and removed
+  this.close = function(callback) {
+    var handles = Object.keys(devices).map(function(serial) { return devices[serial]; });
+    var remaining = handles.length;
+    var firstError = null;
+
+    binding.closeManager();
+    clearTimeout(timer);
+    timer = null;
+    pending = null;
+    closed = true;
+
+    phidget.removeListener("managerAttach", onFound);
+    phidget.removeListener("managerDetach", onLost);
+    phidget.removeListener("attach", onAttach);
+
+    devices = {};
+
+    var done = function(error) {
+      firstError = firstError || error || null;
+
+      if (--remaining === 0 && callback) {
+        callback(firstError);
+      }
+    };
+
+    // A handle that never opened fails to close, it is removed anyway
+    var release = function(device) {
+      device.idle = null;
+      callAsync(binding.closeAsync, [device.handle], function() {
+        callAsync(binding.removeAsync, [device.handle], done);
+      });
+    };
+
+    handles.forEach(function(device) {
+      if (device.jobs === 0) {
+        release(device);
+      } else {
+        device.idle = function() {
+          release(device);
+        };
+      }
+    });
+
+    if (remaining === 0 && callback) {
+      process.nextTick(function() {
+        callback(null);
+      });
+    }
+  };
+
+  this.getDevices = function() {
+    return Object.keys(devices).map(function(serial) {
+      return { serial: devices[serial].serial, handle: devices[serial].handle };
+    });
+  };
+};
+
+util.inherits(DeviceManager, EventEmitter);
 
 var Phidget = function() {
   this.create                 = function()                            { return binding.create(); };
-  this.open                   = function(handle, serialNumber)        { return binding.open(handle, serialNumber); };
+  this.open                   = function(handle, serialNumber)        { binding.open(handle, serialNumber); openedSerials[serialNumber] = handle; };
   this.waitForAttachment      = function(handle, milliseconds)        { return binding.waitForAttachment(handle, milliseconds); };
-  this.close                  = function(handle)                      { return binding.close(handle); };
-  this.remove                 = function(handle)                      { return binding.remove(handle); };
+  this.close                  = function(handle)                      { binding.close(handle); forgetHandle(handle); };
+  this.remove                 = function(handle)                      { binding.remove(handle); forgetHandle(handle); };
+  this.openAsync              = function(handle, serialNumber, cb)    { openedSerials[serialNumber] = handle; return callAsync(binding.openAsync, [handle, serialNumber], cb); };
+  this.waitForAttachmentAsync = function(handle, milliseconds, cb)    { return callAsync(binding.waitForAttachmentAsync, [handle, milliseconds], cb); };
+  this.closeAsync             = function(handle, cb)                  { forgetHandle(handle); return callAsync(binding.closeAsync, [handle], cb); };
+  this.removeAsync            = function(handle, cb)                  { forgetHandle(handle); return callAsync(binding.removeAsync, [handle], cb); };
+  this.configure              = function(handle, options, cb)         { return callAsync(binding.configure, [handle, options], cb); };
+  this.getDeviceNameAsync     = function(handle, cb)                  { return callAsync(binding.getDeviceNameAsync, [handle], cb); };
+  this.getSerialNumberAsync   = function(handle, cb)                  { return callAsync(binding.getSerialNumberAsync, [handle], cb); };
+  this.getDeviceVersionAsync  = function(handle, cb)                  { return callAsync(binding.getDeviceVersionAsync, [handle], cb); };
+  this.getDeviceStatusAsync   = function(handle, cb)                  { return callAsync(binding.getDeviceStatusAsync, [handle], cb); };
+  this.getDeviceTypeAsync     = function(handle, cb)                  { return callAsync(binding.getDeviceTypeAsync, [handle], cb); };
+  this.getInputCountAsync     = function(handle, cb)                  { return callAsync(binding.getInputCountAsync, [handle], cb); };
+  this.getBridgeValueAsync    = function(handle, index, cb)           { return callAsync(binding.getBridgeValueAsync, [handle, index], cb); };
+  this.getBridgeMaxAsync      = function(handle, index, cb)           { return callAsync(binding.getBridgeMaxAsync, [handle, index], cb); };
+  this.getBridgeMinAsync      = function(handle, index, cb)           { return callAsync(binding.getBridgeMinAsync, [handle, index], cb); };
+  this.getEnabledAsync        = function(handle, index, cb)           { return callAsync(binding.getEnabledAsync, [handle, index], cb); };
+  this.setEnabledAsync        = function(handle, index, state, cb)    { return callAsync(binding.setEnabledAsync, [handle, index, state], cb); };
+  this.getGainAsync           = function(handle, index, cb)           { return callAsync(binding.getGainAsync, [handle, index], cb); };
+  this.setGainAsync           = function(handle, index, gain, cb)     { return callAsync(binding.setGainAsync, [handle, index, gain], cb); };
+  this.getDataRateAsync       = function(handle, cb)                  { return callAsync(binding.getDataRateAsync, [handle], cb); };
+  this.setDataRateAsync       = function(handle, milliseconds, cb)    { return callAsync(binding.setDataRateAsync, [handle, milliseconds], cb); };
+  this.getDataRateMaxAsync    = function(handle, cb)                  { return callAsync(binding.getDataRateMaxAsync, [handle], cb); };
+  this.getDataRateMinAsync    = function(handle, cb)                  { return callAsync(binding.getDataRateMinAsync, [handle], cb); };
   this.getDeviceName          = function(handle)                      { return binding.getDeviceName(handle); };
   this.getSerialNumber        = function(handle)                      { return binding.getSerialNumber(handle); };
   this.getDeviceVersion       = function(handle)                      { return binding.getDeviceVersion(handle); };
@@ -27,13 +436,38 @@ var Phidget = function() {
   this.setDataRate            = function(handle, milliseconds)        { return binding.setDataRate(handle, milliseconds); };
   this.getDataRateMax         = function(handle)                      { return binding.getDataRateMax(handle); };
   this.getDataRateMin         = function(handle)                      { return binding.getDataRateMin(handle); };
+  this.getDroppedEvents       = function()                            { return binding.getDroppedEvents(); };
+  this.setBatchMode           = function(enabled)                     { return binding.setBatchMode(enabled); };
+  this.enableSampleBuffer     = function(capacity, dataEvents)        { return binding.enableSampleBuffer(capacity, dataEvents); };
+  this.createSampleReader     = function(capacity, dataEvents)        { return new SampleReader(binding.enableSampleBuffer(capacity, dataEvents)); };
+  this.getPoolStats           = function()                            { return binding.getPoolStats(); };
+  this.setQueueOptions        = function(options)                     { return binding.setQueueOptions(options); };
+  this.getQueueStats          = function()                            { return binding.getQueueStats(); };
+  this.getStats               = function(reset)                       { return binding.getStats(reset); };
+  this.setAggregation         = function(handle, index, options)      { return binding.setAggregation(handle, index, options); };
+  this.setCalibration         = function(handle, index, profile)      { return binding.setCalibration(handle, index, profile); };
+  this.tare                   = function(handle, index, samples, cb)  { return callAsync(binding.tare, [handle, index, samples], cb); };
+  this.getSnapshot            = function(staleMs)                     { return binding.getSnapshot(staleMs); };
+  this.setHistory             = function(handle, index, retentionMs)  { return binding.setHistory(handle, index, retentionMs); };
+  this.getHistory             = function(handle, index, fromMs, toMs) { return binding.getHistory(handle, index, fromMs, toMs); };
+  this.startRecording         = function(handle, path)                { return binding.startRecording(handle, path); };
+  this.stopRecording          = function(handle)                      { return binding.stopRecording(handle); };
+  this.replay                 = function(handle, path, speed, cb)     { return callAsync(binding.replay, [handle, path, speed], cb); };
+  this.stopReplay             = function(handle)                      { return binding.stopReplay(handle); };
+  this.createManager          = function(options)                     { return new DeviceManager(this, options || {}); };
+  this.createReadStream       = function(handle, options)             { return new SampleStream(this, handle, options || {}); };
+  this.pauseDevice            = function(handle, depth)               { return binding.pauseDevice(handle, depth); };
+  this.resumeDevice           = function(handle)                      { return binding.resumeDevice(handle); };
+  this.setChannelStats        = function(handle, index, options)      { return binding.setChannelStats(handle, index, options); };
+  this.getChannelStats        = function(handle, reset)               { return binding.getChannelStats(handle, reset); };
+  this.setFrameMode           = function(handle, options)             { return binding.setFrameMode(handle, options); };
+  this.setFilters             = function(handle, index, filters)      { return binding.setFilters(handle, index, filters); };
+  this.setTriggers            = function(handle, index, triggers)     { return binding.setTriggers(handle, index, triggers); };
+  this.setDataEvents          = function(handle, index, enabled)      { return binding.setDataEvents(handle, index, enabled); };
 };
 
 util.inherits(Phidget, EventEmitter);
 
 module.exports = new Phidget();
 
-binding.context.attachHandler       = function(handle) { module.exports.emit("attach", handle); };
-binding.context.detachHandler       = function(handle) { module.exports.emit("detach", handle); };
-binding.context.errorHandler        = function(handle, errorString) { module.exports.emit("error", handle, errorString); };
-binding.context.dataHandler         = function(handle, index, value) { module.exports.emit("data", handle, index, value); };
+binding.setEmitter(module.exports);
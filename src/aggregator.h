@@ -0,0 +1,110 @@
+#ifndef PHIDGET_BRIDGE_AGGREGATOR_H
+#define PHIDGET_BRIDGE_AGGREGATOR_H
+
+#include <stdint.h>
+
+enum AggregateStats
+{
+    STAT_MIN = 1,
+    STAT_MAX = 2,
+    STAT_MEAN = 4,
+    STAT_LAST = 8,
+    STAT_COUNT = 16,
+    STAT_ALL = 31
+};
+
+class Aggregate
+{
+public:
+    unsigned int stats;
+    unsigned int count;
+    double min;
+    double max;
+    double mean;
+    double last;
+    uint64_t start;
+    uint64_t end;
+};
+
+/*
+ * Folds the samples of one channel into fixed time windows. A window is
+ * closed by the first sample arriving after it has ended, that sample
+ * then opens the next window.
+ */
+class Aggregator
+{
+public:
+    Aggregator() : window(0), stats(0), count(0)
+    {
+    }
+
+    void configure(uint64_t windowNanoseconds, unsigned int statsMask)
+    {
+        window = windowNanoseconds;
+        stats = statsMask;
+        count = 0;
+    }
+
+    bool enabled() const
+    {
+        return window > 0;
+    }
+
+    // Returns true and fills result when value closed a window.
+    bool add(double value, uint64_t timestamp, Aggregate &result)
+    {
+        bool closed = false;
+
+        if (count > 0 && timestamp - start >= window)
+        {
+            result.stats = stats;
+            result.count = count;
+            result.min = min;
+            result.max = max;
+            result.mean = sum / count;
+            result.last = last;
+            result.start = start;
+            result.end = start + window;
+
+            closed = true;
+            count = 0;
+        }
+
+        if (count == 0)
+        {
+            // Keep windows aligned when samples arrive without gaps
+            start = closed && timestamp - start < 2 * window ? start + window : timestamp;
+            min = value;
+            max = value;
+            sum = 0;
+        }
+
+        if (value < min)
+        {
+            min = value;
+        }
+
+        if (value > max)
+        {
+            max = value;
+        }
+
+        sum += value;
+        last = value;
+        count++;
+
+        return closed;
+    }
+
+private:
+    uint64_t window;
+    unsigned int stats;
+    unsigned int count;
+    uint64_t start;
+    double min;
+    double max;
+    double sum;
+    double last;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PHIDGET_BRIDGE_BATON_H
+#define PHIDGET_BRIDGE_BATON_H
+
+#include <stdint.h>
+#include "aggregator.h"
+#include "frame.h"
+#include "trigger.h"
+
+enum Events
+{
+    ATTACH,
+    DETACH,
+    ERROR,
+    DATA,
+    AGGREGATE,
+    TARE,
+    TRIGGER,
+    FRAME,
+    MANAGER_ATTACH,
+    MANAGER_DETACH
+};
+
+// Number of event types, keep in sync with the last entry above
+#define EVENT_TYPES (MANAGER_DETACH + 1)
+
+// Error descriptions longer than this are truncated
+#define ERROR_STRING_LENGTH 256
+
+class Baton
+{
+public:
+    Events event;
+    char errorString[ERROR_STRING_LENGTH];
+    int index;
+    double value;
+    long handle;
+    int serialNumber;
+    uint64_t timestamp;
+    Aggregate aggregate;
+    Crossing crossing;
+    Frame frame;
+};
+
+// Control events are never dropped to make room for data, neither are
+// the rare trigger crossings
+inline bool isControlEvent(Events event)
+{
+    return event == ATTACH || event == DETACH || event == ERROR || event == TARE || event == TRIGGER ||
+           event == MANAGER_ATTACH || event == MANAGER_DETACH;
+}
+
+#endif
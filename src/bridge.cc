@@ -1,100 +1,486 @@
 #include <node.h>
 #include <v8.h>
 #include <phidget21.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <map>
 #include <vector>
-#include <string>
+#include "baton.h"
+#include "device.h"
+#include "histogram.h"
+#include "instance.h"
+#include "queue.h"
+#include "recorder.h"
+#include "replay.h"
+#include "samplebuffer.h"
+#include "trace.h"
 
 using namespace v8;
 
-enum Events
+static const char *eventNames[] = { "attach", "detach", "error", "data", "aggregate", "tare", "trigger", "frame", "managerAttach", "managerDetach" };
+
+// Data events dispatched from one device before moving on to the next
+#define DRAIN_QUANTUM 64
+
+static Baton *newBaton(Device *device, Events event)
 {
-    ATTACH,
-    DETACH,
-    ERROR,
-    DATA
-};
+    return device->instance->eventQueue.acquire((long)device->handle, event);
+}
 
-class Baton
+static void queueBaton(Device *device, Baton *baton)
 {
-public:
-    Events event;
-    std::string errorString;
-    int index;
-    double value;
-    long handle;
-};
+    Instance *instance = device->instance;
+
+    baton->timestamp = uv_hrtime();
 
-static std::vector<Baton*> batons;
-Persistent<Object> contextObj;
-static uv_async_t async;
-static uv_mutex_t mutex;
+    instance->eventQueue.push(baton, device->events, device->queueLimit());
+
+    TRACE_ENQUEUE((long)device->handle, baton->index, (int)baton->event,
+                  isControlEvent(baton->event) ? instance->eventQueue.control.size() : device->events.size());
+
+    uv_async_send(&instance->async);
+}
 
 int CCONV attachHandler(CPhidgetHandle handle, void *userptr)
 {
-    Baton *baton = new Baton;
-    baton->handle = (long)handle;
-    baton->event = ATTACH;
+    Baton *baton = newBaton((Device*)userptr, ATTACH);
 
-    uv_mutex_lock(&mutex);
-    batons.push_back(baton);
-    uv_mutex_unlock(&mutex);
+    if (baton == NULL)
+    {
+        return 0;
+    }
 
-    uv_async_send(&async);
+    queueBaton((Device*)userptr, baton);
 
     return 0;
 }
 
 int CCONV detachHandler(CPhidgetHandle handle, void *userptr)
 {
-    Baton *baton = new Baton;
-    baton->handle = (long)handle;
-    baton->event = DETACH;
+    Baton *baton = newBaton((Device*)userptr, DETACH);
 
-    uv_mutex_lock(&mutex);
-    batons.push_back(baton);
-    uv_mutex_unlock(&mutex);
+    if (baton == NULL)
+    {
+        return 0;
+    }
 
-    uv_async_send(&async);
+    queueBaton((Device*)userptr, baton);
 
     return 0;
 }
 
 int CCONV errorHandler(CPhidgetHandle handle, void *userptr, int errorCode, const char *errorString)
 {
-    Baton *baton = new Baton;
-    baton->handle = (long)handle;
-    baton->event = ERROR;
-    baton->errorString = errorString;
+    Baton *baton = newBaton((Device*)userptr, ERROR);
+
+    if (baton == NULL)
+    {
+        return 0;
+    }
 
-    uv_mutex_lock(&mutex);
-    batons.push_back(baton);
-    uv_mutex_unlock(&mutex);
+    strncpy(baton->errorString, errorString, ERROR_STRING_LENGTH - 1);
+    baton->errorString[ERROR_STRING_LENGTH - 1] = 0;
 
-    uv_async_send(&async);
+    queueBaton((Device*)userptr, baton);
 
     return 0;
 }
 
-int CCONV dataHandler(CPhidgetBridgeHandle handle, void *usrptr, int index, double value)
+// Manager callbacks get a description of the device, not a handle of ours
+static void queueManagerEvent(Instance *instance, CPhidgetHandle handle, Events event)
+{
+    CPhidget_DeviceClass deviceClass;
+    int serialNumber;
+
+    if (CPhidget_getDeviceClass(handle, &deviceClass) != 0 || deviceClass != PHIDCLASS_BRIDGE)
+    {
+        return;
+    }
+
+    if (CPhidget_getSerialNumber(handle, &serialNumber) != 0)
+    {
+        return;
+    }
+
+    Baton *baton = instance->eventQueue.acquire(0, event);
+
+    if (baton == NULL)
+    {
+        return;
+    }
+
+    baton->serialNumber = serialNumber;
+    baton->timestamp = uv_hrtime();
+
+    instance->eventQueue.pushControl(baton);
+
+    TRACE_ENQUEUE(0L, -1, (int)event, instance->eventQueue.control.size());
+
+    uv_async_send(&instance->async);
+}
+
+int CCONV managerAttachHandler(CPhidgetHandle handle, void *userptr)
+{
+    queueManagerEvent((Instance*)userptr, handle, MANAGER_ATTACH);
+
+    return 0;
+}
+
+int CCONV managerDetachHandler(CPhidgetHandle handle, void *userptr)
+{
+    queueManagerEvent((Instance*)userptr, handle, MANAGER_DETACH);
+
+    return 0;
+}
+
+static void queueIndexed(Device *device, Events event, int index, double value)
 {
-    Baton *baton = new Baton;
-    baton->handle = (long)handle;
-    baton->event = DATA;
+    Baton *baton = newBaton(device, event);
+
+    if (baton == NULL)
+    {
+        return;
+    }
+
     baton->index = index;
     baton->value = value;
 
-    uv_mutex_lock(&mutex);
-    batons.push_back(baton);
-    uv_mutex_unlock(&mutex);
+    queueBaton(device, baton);
+}
+
+int CCONV dataHandler(CPhidgetBridgeHandle handle, void *usrptr, int index, double value)
+{
+    Device *device = (Device*)usrptr;
+    Instance *instance = device->instance;
+    uint64_t timestamp = uv_hrtime();
+    Aggregate aggregate;
+    Crossing crossings[MAX_TRIGGERS];
+    Frame frames[2];
+    bool tared = false, aggregated = false, closed = false, dataEvents = true, framing = false, historyWanted = false;
+    int fired = 0, framed = 0;
+    double offset;
+
+    if (index >= 0 && index < MAX_INPUTS)
+    {
+        Channel &channel = device->channels[index];
+
+        uv_mutex_lock(&device->mutex);
+
+        // Recorded as the library reports it, so a replay goes through
+        // calibration and aggregation again
+        if (device->recorder != NULL)
+        {
+            device->recorder->add(index, value, timestamp);
+        }
+
+        if (channel.calibration.taring())
+        {
+            tared = channel.calibration.addTareSample(value, offset);
+        }
+
+        value = channel.calibration.apply(value);
+
+        if (channel.filters.enabled())
+        {
+            value = channel.filters.apply(value);
+        }
+
+        channel.latest = value;
+        channel.latestTimestamp = timestamp;
+
+        if (channel.history.enabled())
+        {
+            historyWanted = channel.history.add(timestamp, value);
+        }
+
+        if (channel.stats.enabled())
+        {
+            channel.stats.add(value);
+        }
+
+        if (channel.aggregator.enabled())
+        {
+            aggregated = true;
+            closed = channel.aggregator.add(value, timestamp, aggregate);
+        }
+
+        if (channel.triggers.enabled())
+        {
+            fired = channel.triggers.evaluate(value, timestamp, crossings);
+        }
+
+        // Aggregated channels keep their own events
+        if (!aggregated && device->frames.holds(index))
+        {
+            framing = true;
+            framed = device->frames.add(index, value, timestamp, frames);
+        }
+
+        dataEvents = channel.dataEvents;
+
+        uv_mutex_unlock(&device->mutex);
+    }
+
+    if (historyWanted)
+    {
+        instance->historyPending.store(true, std::memory_order_release);
+        uv_async_send(&instance->async);
+    }
+
+    if (tared)
+    {
+        queueIndexed(device, TARE, index, offset);
+    }
+
+    for (int n = 0; n < fired; n++)
+    {
+        Baton *baton = newBaton(device, TRIGGER);
+
+        if (baton != NULL)
+        {
+            baton->index = index;
+            baton->value = crossings[n].value;
+            baton->crossing = crossings[n];
+            queueBaton(device, baton);
+        }
+    }
+
+    SampleBuffer *buffer = instance->sampleBuffer.load(std::memory_order_acquire);
+
+    if (buffer != NULL)
+    {
+        buffer->write((long)handle, index, value, timestamp / 1e6);
+
+        // The buffer replaces data events only, aggregates and frames stay
+        if (!instance->sampleBufferEvents.load(std::memory_order_relaxed))
+        {
+            dataEvents = false;
+        }
+    }
+
+    // Aggregated channels only report once per window
+    if (aggregated)
+    {
+        if (closed)
+        {
+            Baton *baton = newBaton(device, AGGREGATE);
+
+            if (baton != NULL)
+            {
+                baton->index = index;
+                baton->aggregate = aggregate;
+                queueBaton(device, baton);
+            }
+        }
+
+        return 0;
+    }
+
+    // Framed channels only report as part of a frame
+    if (framing)
+    {
+        for (int n = 0; n < framed; n++)
+        {
+            Baton *baton = newBaton(device, FRAME);
+
+            if (baton != NULL)
+            {
+                baton->frame = frames[n];
+                queueBaton(device, baton);
+            }
+        }
+
+        return 0;
+    }
+
+    if (!dataEvents)
+    {
+        return 0;
+    }
+
+    // Replace the held back sample instead of queueing while the queue is full
+    if (instance->eventQueue.policy() == COALESCE && index >= 0 && index < MAX_INPUTS && instance->eventQueue.full(device->events, device->queueLimit()))
+    {
+        Channel &channel = device->channels[index];
+
+        uv_mutex_lock(&device->mutex);
 
-    uv_async_send(&async);
+        if (channel.coalesced)
+        {
+            instance->eventQueue.countCoalesced();
+        }
+
+        channel.coalesced = true;
+        channel.coalescedValue = value;
+        channel.coalescedTimestamp = timestamp;
+
+        uv_mutex_unlock(&device->mutex);
+
+        instance->coalescePending.store(true, std::memory_order_release);
+        uv_async_send(&instance->async);
+
+        return 0;
+    }
+
+    queueIndexed(device, DATA, index, value);
 
     return 0;
 }
 
+static void replaySample(void *context, int index, double value);
+
+// A replay in progress, deleted once its callback has been called
+class ReplayJob
+{
+public:
+    ReplayJob(Instance *instance, Device *device) : instance(instance), device(device), replay(replaySample, this)
+    {
+    }
+
+    Instance *instance;
+
+    // NULL once the handle has been removed
+    Device *device;
+    Replay replay;
+    uv_async_t done;
+    Persistent<Function> callback;
+};
+
+// Replayed samples enter exactly where the library delivers them
+static void replaySample(void *context, int index, double value)
+{
+    Device *device = ((ReplayJob*)context)->device;
+
+    dataHandler((CPhidgetBridgeHandle)device->handle, device, index, value);
+}
+
+static Device *findDevice(Instance *instance, long handle)
+{
+    std::map<long, Device*>::iterator it = instance->devices.find(handle);
+
+    return it != instance->devices.end() ? it->second : NULL;
+}
+
+static void releaseDevice(Device *device)
+{
+    Instance *instance = device->instance;
+    std::map<long, ReplayJob*>::iterator replay = instance->replays.find((long)device->handle);
+    Baton *baton;
+
+    // The callback is still called once the replay thread is gone
+    if (replay != instance->replays.end())
+    {
+        replay->second->replay.stop();
+        replay->second->device = NULL;
+        instance->replays.erase(replay);
+    }
+
+    delete device->recorder;
+
+    while (device->events.pop(baton))
+    {
+        instance->eventQueue.release(baton);
+    }
+
+    for (std::vector<Device*>::iterator it = instance->deviceOrder.begin(); it != instance->deviceOrder.end(); ++it)
+    {
+        if (*it == device)
+        {
+            instance->deviceOrder.erase(it);
+            break;
+        }
+    }
+
+    delete device;
+}
+
+static void callFunction(Handle<Object> receiver, Handle<Function> function, int argc, Handle<Value> argv[]);
+
+// A JS callback may remove a handle while the queues are being drained,
+// the record is then kept until the drain is done.
+static void unregisterDevice(Instance *instance, long handle)
+{
+    std::map<long, Device*>::iterator it = instance->devices.find(handle);
+
+    if (it != instance->devices.end())
+    {
+        Device *device = it->second;
+
+        instance->devices.erase(it);
+        device->removed = true;
+
+        if (!instance->draining)
+        {
+            releaseDevice(device);
+        }
+    }
+
+    for (int index = 0; index < MAX_INPUTS; index++)
+    {
+        std::map<std::pair<long, int>, Persistent<Function> >::iterator callback = instance->tareCallbacks.find(std::make_pair(handle, index));
+
+        // Taring will not finish, the callback is told so
+        if (callback != instance->tareCallbacks.end())
+        {
+            HandleScope scope;
+            Persistent<Function> function = callback->second;
+            Local<Value> args[] = { Exception::Error(String::New("Device removed")) };
+
+            instance->tareCallbacks.erase(callback);
+            callFunction(Context::GetCurrent()->Global(), function, 1, args);
+            function.Dispose();
+        }
+    }
+}
+
+// Paused devices only count when includePaused is set
+static size_t queuedData(Instance *instance, bool includePaused = true)
+{
+    size_t depth = 0;
+
+    for (size_t n = 0; n < instance->deviceOrder.size(); n++)
+    {
+        Device *device = instance->deviceOrder[n];
+
+        if (includePaused || device->pausedDepth.load(std::memory_order_relaxed) == 0)
+        {
+            depth += device->events.size();
+        }
+    }
+
+    return depth;
+}
+
+static Instance *unwrapInstance(const Arguments& args)
+{
+    return (Instance*)Local<External>::Cast(args.Data())->Value();
+}
+
+// Synchronous calls must not use a handle a remove job is deleting
+static bool removing(const Arguments& args)
+{
+    Device *device = findDevice(unwrapInstance(args), (long)args[0]->IntegerValue());
+
+    return device != NULL && device->removing;
+}
+
+static Local<Object> newTypedArray(const char *type, size_t length, void **data)
+{
+    Local<Function> constructor = Local<Function>::Cast(Context::GetCurrent()->Global()->Get(String::NewSymbol(type)));
+    Local<Value> argv[] = { Integer::NewFromUnsigned(length) };
+    Local<Object> array = constructor->NewInstance(1, argv);
+
+    *data = array->GetIndexedPropertiesExternalArrayData();
+
+    return array;
+}
+
 Handle<Value> create(const Arguments& args)
 {
     HandleScope scope;
+    Instance *instance = unwrapInstance(args);
     int errorCode;
     const char *errorDescription;
     CPhidgetHandle handle = 0;
@@ -108,43 +494,77 @@ Handle<Value> create(const Arguments& args)
         return scope.Close(Undefined());
     }
 
-    errorCode = CPhidget_set_OnAttach_Handler(handle, attachHandler, NULL);
+    // Registered once every handler is set, a failure then leaves nothing
+    // behind. No handler runs before the handle is opened.
+    Device *device = new Device(instance, handle);
 
-    if (errorCode != 0)
+    if ((errorCode = CPhidget_set_OnAttach_Handler(handle, attachHandler, device)) != 0 ||
+        (errorCode = CPhidget_set_OnDetach_Handler(handle, detachHandler, device)) != 0 ||
+        (errorCode = CPhidget_set_OnError_Handler(handle, errorHandler, device)) != 0 ||
+        (errorCode = CPhidgetBridge_set_OnBridgeData_Handler((CPhidgetBridgeHandle)handle, dataHandler, device)) != 0)
     {
+        CPhidget_delete(handle);
+        delete device;
+
         CPhidget_getErrorDescription(errorCode, &errorDescription);
         ThrowException(Exception::TypeError(String::New(errorDescription)));
         return scope.Close(Undefined());
     }
 
-    errorCode = CPhidget_set_OnDetach_Handler(handle, detachHandler, NULL);
+    instance->devices[(long)handle] = device;
+    instance->deviceOrder.push_back(device);
 
-    if (errorCode != 0)
+    return scope.Close(Number::New((long)handle));
+}
+
+Handle<Value> openManager(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    int errorCode;
+    const char *errorDescription;
+
+    if (instance->manager != NULL)
     {
-        CPhidget_getErrorDescription(errorCode, &errorDescription);
-        ThrowException(Exception::TypeError(String::New(errorDescription)));
         return scope.Close(Undefined());
     }
 
-    errorCode = CPhidget_set_OnError_Handler(handle, errorHandler, NULL);
+    if ((errorCode = CPhidgetManager_create(&instance->manager)) == 0 &&
+        (errorCode = CPhidgetManager_set_OnAttach_Handler(instance->manager, managerAttachHandler, instance)) == 0 &&
+        (errorCode = CPhidgetManager_set_OnDetach_Handler(instance->manager, managerDetachHandler, instance)) == 0)
+    {
+        errorCode = CPhidgetManager_open(instance->manager);
+    }
 
     if (errorCode != 0)
     {
+        if (instance->manager != NULL)
+        {
+            CPhidgetManager_delete(instance->manager);
+            instance->manager = NULL;
+        }
+
         CPhidget_getErrorDescription(errorCode, &errorDescription);
         ThrowException(Exception::TypeError(String::New(errorDescription)));
         return scope.Close(Undefined());
     }
 
-    errorCode = CPhidgetBridge_set_OnBridgeData_Handler((CPhidgetBridgeHandle)handle, dataHandler, NULL);
+    return scope.Close(Undefined());
+}
 
-    if (errorCode != 0)
+Handle<Value> closeManager(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (instance->manager != NULL)
     {
-        CPhidget_getErrorDescription(errorCode, &errorDescription);
-        ThrowException(Exception::TypeError(String::New(errorDescription)));
-        return scope.Close(Undefined());
+        CPhidgetManager_close(instance->manager);
+        CPhidgetManager_delete(instance->manager);
+        instance->manager = NULL;
     }
 
-    return scope.Close(Number::New((long)handle));
+    return scope.Close(Undefined());
 }
 
 Handle<Value> open(const Arguments& args)
@@ -165,6 +585,12 @@ Handle<Value> open(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_open((CPhidgetHandle)args[0]->IntegerValue(), args[1]->Int32Value());
 
     if (errorCode != 0)
@@ -195,6 +621,12 @@ Handle<Value> waitForAttachment(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_waitForAttachment((CPhidgetHandle)args[0]->IntegerValue(), args[1]->Int32Value());
 
     if (errorCode != 0)
@@ -225,6 +657,12 @@ Handle<Value> close(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_close((CPhidgetHandle)args[0]->IntegerValue());
 
     if (errorCode != 0)
@@ -240,6 +678,7 @@ Handle<Value> close(const Arguments& args)
 Handle<Value> remove(const Arguments& args)
 {
     HandleScope scope;
+    Instance *instance = unwrapInstance(args);
     int errorCode;
     const char *errorDescription;
 
@@ -255,17 +694,34 @@ Handle<Value> remove(const Arguments& args)
         return scope.Close(Undefined());
     }
 
-    errorCode = CPhidget_delete((CPhidgetHandle)args[0]->IntegerValue());
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
 
-    if (errorCode != 0)
+    if (device == NULL)
     {
-        CPhidget_getErrorDescription(errorCode, &errorDescription);
-        ThrowException(Exception::TypeError(String::New(errorDescription)));
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
         return scope.Close(Undefined());
     }
 
-    return scope.Close(Undefined());
-}
+    // Jobs on the thread pool would be left with a deleted handle
+    if (device->jobs > 0)
+    {
+        ThrowException(Exception::TypeError(String::New("Operation in progress")));
+        return scope.Close(Undefined());
+    }
+
+    errorCode = CPhidget_delete((CPhidgetHandle)args[0]->IntegerValue());
+
+    if (errorCode != 0)
+    {
+        CPhidget_getErrorDescription(errorCode, &errorDescription);
+        ThrowException(Exception::TypeError(String::New(errorDescription)));
+        return scope.Close(Undefined());
+    }
+
+    unregisterDevice(instance, (long)args[0]->IntegerValue());
+
+    return scope.Close(Undefined());
+}
 
 Handle<Value> getDeviceName(const Arguments& args)
 {
@@ -285,6 +741,12 @@ Handle<Value> getDeviceName(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_getDeviceName((CPhidgetHandle)args[0]->IntegerValue(), &deviceName);
 
     if (errorCode != 0)
@@ -315,6 +777,12 @@ Handle<Value> getSerialNumber(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_getSerialNumber((CPhidgetHandle)args[0]->IntegerValue(), &serialNumber);
 
     if (errorCode != 0)
@@ -345,6 +813,12 @@ Handle<Value> getDeviceVersion(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_getDeviceVersion((CPhidgetHandle)args[0]->IntegerValue(), &deviceVersion);
 
     if (errorCode != 0)
@@ -375,6 +849,12 @@ Handle<Value> getDeviceStatus(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_getDeviceStatus((CPhidgetHandle)args[0]->IntegerValue(), &deviceStatus);
 
     if (errorCode != 0)
@@ -423,6 +903,12 @@ Handle<Value> getDeviceType(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidget_getDeviceType((CPhidgetHandle)args[0]->IntegerValue(), &deviceType);
 
     if (errorCode != 0)
@@ -453,6 +939,12 @@ Handle<Value> getInputCount(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getInputCount((CPhidgetBridgeHandle)args[0]->IntegerValue(), &count);
 
     if (errorCode != 0)
@@ -484,6 +976,12 @@ Handle<Value> getBridgeValue(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getBridgeValue((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), &value);
 
     if (errorCode != 0)
@@ -515,6 +1013,12 @@ Handle<Value> getBridgeMax(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getBridgeMax((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), &max);
 
     if (errorCode != 0)
@@ -546,6 +1050,12 @@ Handle<Value> getBridgeMin(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getBridgeMin((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), &min);
 
     if (errorCode != 0)
@@ -576,6 +1086,12 @@ Handle<Value> setEnabled(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_setEnabled((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), args[2]->Int32Value());
 
     if (errorCode != 0)
@@ -606,6 +1122,12 @@ Handle<Value> getEnabled(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getEnabled((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), &enabledState);
 
     if (errorCode != 0)
@@ -637,6 +1159,12 @@ Handle<Value> getGain(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getGain((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), &gain);
 
     if (errorCode != 0)
@@ -667,6 +1195,12 @@ Handle<Value> setGain(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_setGain((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value(), (CPhidgetBridge_Gain)args[2]->Int32Value());
 
     if (errorCode != 0)
@@ -697,6 +1231,12 @@ Handle<Value> getDataRate(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getDataRate((CPhidgetBridgeHandle)args[0]->IntegerValue(), &milliseconds);
 
     if (errorCode != 0)
@@ -727,6 +1267,12 @@ Handle<Value> setDataRate(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_setDataRate((CPhidgetBridgeHandle)args[0]->IntegerValue(), args[1]->Int32Value());
 
     if (errorCode != 0)
@@ -757,6 +1303,12 @@ Handle<Value> getDataRateMax(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getDataRateMax((CPhidgetBridgeHandle)args[0]->IntegerValue(), &max);
 
     if (errorCode != 0)
@@ -787,6 +1339,12 @@ Handle<Value> getDataRateMin(const Arguments& args)
         return scope.Close(Undefined());
     }
 
+    if (removing(args))
+    {
+        ThrowException(Exception::TypeError(String::New("Remove in progress")));
+        return scope.Close(Undefined());
+    }
+
     errorCode = CPhidgetBridge_getDataRateMin((CPhidgetBridgeHandle)args[0]->IntegerValue(), &min);
 
     if (errorCode != 0)
@@ -799,81 +1357,2977 @@ Handle<Value> getDataRateMin(const Arguments& args)
     return scope.Close(Number::New(min));
 }
 
-void eventCallback(uv_async_t *handle, int status /*UNUSED*/)
+enum Operations
 {
-    HandleScope scope;
-    uv_mutex_lock(&mutex);
+    OPEN,
+    WAIT_FOR_ATTACHMENT,
+    CLOSE,
+    REMOVE,
+    CONFIGURE,
+
+    // Reads, identical ones in flight at the same time share one call
+    GET_DEVICE_NAME,
+    GET_SERIAL_NUMBER,
+    GET_DEVICE_VERSION,
+    GET_DEVICE_STATUS,
+    GET_DEVICE_TYPE,
+    GET_INPUT_COUNT,
+    GET_BRIDGE_VALUE,
+    GET_BRIDGE_MAX,
+    GET_BRIDGE_MIN,
+    GET_ENABLED,
+    GET_GAIN,
+    GET_DATA_RATE,
+    GET_DATA_RATE_MAX,
+    GET_DATA_RATE_MIN,
+
+    SET_ENABLED,
+    SET_GAIN,
+    SET_DATA_RATE
+};
+
+static bool isRead(Operations operation)
+{
+    return operation >= GET_DEVICE_NAME && operation <= GET_DATA_RATE_MIN;
+}
+
+// One field of a configure() call
+class Setting
+{
+public:
+    Setting() : requested(false), errorCode(0), changed(false), rolledBack(false)
+    {
+    }
+
+    bool requested;
+    int value;
+    int errorCode;
+    bool changed;
+
+    // Value read before writing, restored when another field fails
+    int previous;
+    bool rolledBack;
+};
+
+class Configuration
+{
+public:
+    Configuration() : channelCount(0)
+    {
+    }
+
+    Setting dataRate;
+    Setting gains[MAX_INPUTS];
+    Setting enabled[MAX_INPUTS];
+    int channelCount;
+};
+
+// Blocking library call run on the libuv thread pool, completed by calling
+// the JS callback with an error or null.
+class WorkBaton
+{
+public:
+    WorkBaton() : device(NULL), configuration(NULL), number(0), text(NULL)
+    {
+    }
+
+    ~WorkBaton()
+    {
+        delete configuration;
+    }
+
+    uv_work_t request;
+    Instance *instance;
+    Device *device;
+    Operations operation;
+    CPhidgetHandle handle;
+    int argument;
+    int value;
+    int errorCode;
+    Configuration *configuration;
+
+    // Result of a read, text is owned by the library
+    double number;
+    const char *text;
+
+    Persistent<Function> callback;
+
+    // Callbacks of identical reads that joined this one
+    std::vector<Persistent<Function> > waiters;
+};
+
+// False when the field was not requested, could not be read or already
+// has the requested value
+static bool needsWrite(Setting &setting, int errorCode, int current)
+{
+    if (!setting.requested)
+    {
+        return false;
+    }
+
+    setting.errorCode = errorCode;
+    setting.previous = current;
+
+    return errorCode == 0 && current != setting.value;
+}
+
+static void restore(Setting &setting, int errorCode)
+{
+    if (errorCode == 0)
+    {
+        setting.changed = false;
+        setting.rolledBack = true;
+    }
+}
 
-    for (unsigned i = 0; i < batons.size(); i++)
+// Sets the fields written so far back to their previous values, in the
+// reverse of the order applyConfiguration wrote them, so a failed
+// configure() does not leave a mix of old and new settings. Fields that
+// cannot be restored stay changed.
+static void rollBack(CPhidgetBridgeHandle handle, Configuration &configuration)
+{
+    for (int index = configuration.channelCount - 1; index >= 0; index--)
     {
-        Baton *baton = batons[i];
+        Setting &setting = configuration.enabled[index];
 
-        switch (baton->event)
+        if (setting.changed)
         {
-            case ATTACH:
-            {
-                Local<Value> args[] = { Number::New(baton->handle) };
-                node::MakeCallback(contextObj, "attachHandler", 1, args);
-                break;
-            }
-            case DETACH:
-            {
-                Local<Value> args[] = { Number::New(baton->handle) };
-                node::MakeCallback(contextObj, "detachHandler", 1, args);
-                break;
-            }
-            case ERROR:
+            restore(setting, CPhidgetBridge_setEnabled(handle, index, setting.previous));
+        }
+    }
+
+    for (int index = configuration.channelCount - 1; index >= 0; index--)
+    {
+        Setting &setting = configuration.gains[index];
+
+        if (setting.changed)
+        {
+            restore(setting, CPhidgetBridge_setGain(handle, index, (CPhidgetBridge_Gain)setting.previous));
+        }
+    }
+
+    if (configuration.dataRate.changed)
+    {
+        restore(configuration.dataRate, CPhidgetBridge_setDataRate(handle, configuration.dataRate.previous));
+    }
+}
+
+static bool anyFailed(const Configuration &configuration)
+{
+    bool failed = configuration.dataRate.errorCode != 0;
+
+    for (int index = 0; index < configuration.channelCount; index++)
+    {
+        failed = failed || configuration.gains[index].errorCode != 0 || configuration.enabled[index].errorCode != 0;
+    }
+
+    return failed;
+}
+
+static int applyConfiguration(CPhidgetBridgeHandle handle, Configuration &configuration)
+{
+    int errorCode, count, min, max, current;
+    CPhidgetBridge_Gain gain;
+
+    // Checks that depend on the device come first, so an invalid request
+    // does not get half applied
+    if ((errorCode = CPhidgetBridge_getInputCount(handle, &count)) != 0)
+    {
+        return errorCode;
+    }
+
+    if (configuration.channelCount > count)
+    {
+        return EPHIDGET_OUTOFBOUNDS;
+    }
+
+    if (configuration.dataRate.requested)
+    {
+        if ((errorCode = CPhidgetBridge_getDataRateMin(handle, &min)) != 0 || (errorCode = CPhidgetBridge_getDataRateMax(handle, &max)) != 0)
+        {
+            return errorCode;
+        }
+
+        if (configuration.dataRate.value < (min < max ? min : max) || configuration.dataRate.value > (min < max ? max : min))
+        {
+            return EPHIDGET_OUTOFBOUNDS;
+        }
+
+        errorCode = CPhidgetBridge_getDataRate(handle, &current);
+
+        if (needsWrite(configuration.dataRate, errorCode, current))
+        {
+            configuration.dataRate.errorCode = CPhidgetBridge_setDataRate(handle, configuration.dataRate.value);
+            configuration.dataRate.changed = configuration.dataRate.errorCode == 0;
+        }
+    }
+
+    // Gains before enables, so a channel never starts with the old gain
+    for (int index = 0; index < configuration.channelCount; index++)
+    {
+        Setting &setting = configuration.gains[index];
+
+        if (setting.requested)
+        {
+            errorCode = CPhidgetBridge_getGain(handle, index, &gain);
+
+            if (needsWrite(setting, errorCode, gain))
             {
-                Local<Value> args[] = { Number::New(baton->handle), String::New(baton->errorString.c_str()) };
-                node::MakeCallback(contextObj, "errorHandler", 2, args);
-                break;
+                setting.errorCode = CPhidgetBridge_setGain(handle, index, (CPhidgetBridge_Gain)setting.value);
+                setting.changed = setting.errorCode == 0;
             }
-            case DATA:
+        }
+    }
+
+    for (int index = 0; index < configuration.channelCount; index++)
+    {
+        Setting &setting = configuration.enabled[index];
+
+        if (setting.requested)
+        {
+            errorCode = CPhidgetBridge_getEnabled(handle, index, &current);
+
+            if (needsWrite(setting, errorCode, current ? 1 : 0))
             {
-                Local<Value> args[] = { Number::New(baton->handle), Number::New(baton->index), Number::New(baton->value) };
-                node::MakeCallback(contextObj, "dataHandler", 3, args);
-                break;
+                setting.errorCode = CPhidgetBridge_setEnabled(handle, index, setting.value);
+                setting.changed = setting.errorCode == 0;
             }
         }
+    }
+
+    if (anyFailed(configuration))
+    {
+        rollBack(handle, configuration);
+    }
+
+    return 0;
+}
+
+void workCallback(uv_work_t *request)
+{
+    WorkBaton *work = (WorkBaton*)request->data;
+    CPhidgetBridgeHandle bridge = (CPhidgetBridgeHandle)work->handle;
+    CPhidgetBridge_Gain gain;
+    int result = 0;
+
+    switch (work->operation)
+    {
+        case OPEN:
+            work->errorCode = CPhidget_open(work->handle, work->argument);
+            break;
+        case WAIT_FOR_ATTACHMENT:
+            work->errorCode = CPhidget_waitForAttachment(work->handle, work->argument);
+            break;
+        case CLOSE:
+            work->errorCode = CPhidget_close(work->handle);
+            break;
+        case REMOVE:
+            work->errorCode = CPhidget_delete(work->handle);
+            break;
+        case CONFIGURE:
+            work->errorCode = applyConfiguration((CPhidgetBridgeHandle)work->handle, *work->configuration);
+            break;
+        case GET_DEVICE_NAME:
+            work->errorCode = CPhidget_getDeviceName(work->handle, &work->text);
+            break;
+        case GET_SERIAL_NUMBER:
+            work->errorCode = CPhidget_getSerialNumber(work->handle, &result);
+            work->number = result;
+            break;
+        case GET_DEVICE_VERSION:
+            work->errorCode = CPhidget_getDeviceVersion(work->handle, &result);
+            work->number = result;
+            break;
+        case GET_DEVICE_STATUS:
+            work->errorCode = CPhidget_getDeviceStatus(work->handle, &result);
+            work->number = result;
+            break;
+        case GET_DEVICE_TYPE:
+            work->errorCode = CPhidget_getDeviceType(work->handle, &work->text);
+            break;
+        case GET_INPUT_COUNT:
+            work->errorCode = CPhidgetBridge_getInputCount(bridge, &result);
+            work->number = result;
+            break;
+        case GET_BRIDGE_VALUE:
+            work->errorCode = CPhidgetBridge_getBridgeValue(bridge, work->argument, &work->number);
+            break;
+        case GET_BRIDGE_MAX:
+            work->errorCode = CPhidgetBridge_getBridgeMax(bridge, work->argument, &work->number);
+            break;
+        case GET_BRIDGE_MIN:
+            work->errorCode = CPhidgetBridge_getBridgeMin(bridge, work->argument, &work->number);
+            break;
+        case GET_ENABLED:
+            work->errorCode = CPhidgetBridge_getEnabled(bridge, work->argument, &result);
+            work->number = result;
+            break;
+        case GET_GAIN:
+            work->errorCode = CPhidgetBridge_getGain(bridge, work->argument, &gain);
+            work->number = gain;
+            break;
+        case GET_DATA_RATE:
+            work->errorCode = CPhidgetBridge_getDataRate(bridge, &result);
+            work->number = result;
+            break;
+        case GET_DATA_RATE_MAX:
+            work->errorCode = CPhidgetBridge_getDataRateMax(bridge, &result);
+            work->number = result;
+            break;
+        case GET_DATA_RATE_MIN:
+            work->errorCode = CPhidgetBridge_getDataRateMin(bridge, &result);
+            work->number = result;
+            break;
+        case SET_ENABLED:
+            work->errorCode = CPhidgetBridge_setEnabled(bridge, work->argument, work->value);
+            break;
+        case SET_GAIN:
+            work->errorCode = CPhidgetBridge_setGain(bridge, work->argument, (CPhidgetBridge_Gain)work->value);
+            break;
+        case SET_DATA_RATE:
+            work->errorCode = CPhidgetBridge_setDataRate(bridge, work->argument);
+            break;
+    }
+}
+
+// "changed", "unchanged" or the error description
+static Local<Value> settingResult(const Setting &setting)
+{
+    const char *errorDescription;
 
+    if (setting.errorCode != 0)
+    {
+        CPhidget_getErrorDescription(setting.errorCode, &errorDescription);
+        return String::New(errorDescription);
+    }
 
-        delete baton;
+    if (setting.rolledBack)
+    {
+        return String::New("rolledBack");
     }
 
-    batons.erase(batons.begin(), batons.end());
-    uv_mutex_unlock(&mutex);
+    return String::New(setting.changed ? "changed" : "unchanged");
 }
 
-void init(Handle<Object> target)
+// Mirrors the configure() options, failed is set when any field failed
+static Local<Object> configurationResult(const Configuration &configuration, int &failed)
+{
+    Local<Object> result = Object::New();
+    Local<Array> channels = Array::New(configuration.channelCount);
+
+    failed = configuration.dataRate.errorCode;
+
+    if (configuration.dataRate.requested)
+    {
+        result->Set(String::NewSymbol("dataRate"), settingResult(configuration.dataRate));
+    }
+
+    for (int index = 0; index < configuration.channelCount; index++)
+    {
+        Local<Object> channel = Object::New();
+
+        if (configuration.gains[index].requested)
+        {
+            channel->Set(String::NewSymbol("gain"), settingResult(configuration.gains[index]));
+            failed = failed != 0 ? failed : configuration.gains[index].errorCode;
+        }
+
+        if (configuration.enabled[index].requested)
+        {
+            channel->Set(String::NewSymbol("enabled"), settingResult(configuration.enabled[index]));
+            failed = failed != 0 ? failed : configuration.enabled[index].errorCode;
+        }
+
+        channels->Set(index, channel);
+    }
+
+    result->Set(String::NewSymbol("channels"), channels);
+
+    return result;
+}
+
+static ReadKey readKey(WorkBaton *work)
+{
+    return std::make_pair(std::make_pair((long)work->handle, work->argument), (int)work->operation);
+}
+
+static void forgetReads(Instance *instance, long handle)
+{
+    std::map<ReadKey, WorkBaton*>::iterator it = instance->pendingReads.begin();
+
+    while (it != instance->pendingReads.end())
+    {
+        if (it->first.first.first == handle)
+        {
+            instance->pendingReads.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Counts the job against its handle, a remove only starts once the others
+// are done and no job starts after it. Returns why the job cannot start,
+// or NULL.
+static const char *beginJob(WorkBaton *work)
 {
-    contextObj = Persistent<Object>::New(Object::New());
-
-    target->Set(String::New("context"), contextObj);
-    target->Set(String::New("create"), FunctionTemplate::New(create)->GetFunction());
-    target->Set(String::New("open"), FunctionTemplate::New(open)->GetFunction());
-    target->Set(String::New("waitForAttachment"), FunctionTemplate::New(waitForAttachment)->GetFunction());
-    target->Set(String::New("close"), FunctionTemplate::New(close)->GetFunction());
-    target->Set(String::New("remove"), FunctionTemplate::New(remove)->GetFunction());
-    target->Set(String::New("getDeviceName"), FunctionTemplate::New(getDeviceName)->GetFunction());
-    target->Set(String::New("getSerialNumber"), FunctionTemplate::New(getSerialNumber)->GetFunction());
-    target->Set(String::New("getDeviceVersion"), FunctionTemplate::New(getDeviceVersion)->GetFunction());
-    target->Set(String::New("getDeviceStatus"), FunctionTemplate::New(getDeviceStatus)->GetFunction());
-    target->Set(String::New("getLibraryVersion"), FunctionTemplate::New(getLibraryVersion)->GetFunction());
-    target->Set(String::New("getDeviceType"), FunctionTemplate::New(getDeviceType)->GetFunction());
-    target->Set(String::New("getInputCount"), FunctionTemplate::New(getInputCount)->GetFunction());
-    target->Set(String::New("getBridgeValue"), FunctionTemplate::New(getBridgeValue)->GetFunction());
-    target->Set(String::New("getBridgeMax"), FunctionTemplate::New(getBridgeMax)->GetFunction());
-    target->Set(String::New("getBridgeMin"), FunctionTemplate::New(getBridgeMin)->GetFunction());
-    target->Set(String::New("setEnabled"), FunctionTemplate::New(setEnabled)->GetFunction());
-    target->Set(String::New("getEnabled"), FunctionTemplate::New(getEnabled)->GetFunction());
-    target->Set(String::New("getGain"), FunctionTemplate::New(getGain)->GetFunction());
-    target->Set(String::New("setGain"), FunctionTemplate::New(setGain)->GetFunction());
-    target->Set(String::New("getDataRate"), FunctionTemplate::New(getDataRate)->GetFunction());
-    target->Set(String::New("setDataRate"), FunctionTemplate::New(setDataRate)->GetFunction());
-    target->Set(String::New("getDataRateMax"), FunctionTemplate::New(getDataRateMax)->GetFunction());
-    target->Set(String::New("getDataRateMin"), FunctionTemplate::New(getDataRateMin)->GetFunction());
-
-    uv_async_init(uv_default_loop(), &async, eventCallback);
+    Device *device = findDevice(work->instance, (long)work->handle);
+
+    if (device == NULL)
+    {
+        return "Unknown handle";
+    }
+
+    if (device->removing)
+    {
+        return "Remove in progress";
+    }
+
+    if (work->operation == REMOVE)
+    {
+        if (device->jobs > 0)
+        {
+            return "Operation in progress";
+        }
+
+        device->removing = true;
+    }
+
+    device->jobs++;
+    work->device = device;
+
+    return NULL;
+}
+
+static void endJob(WorkBaton *work)
+{
+    work->device->jobs--;
+
+    if (work->operation == REMOVE && work->errorCode != 0)
+    {
+        work->device->removing = false;
+    }
+}
+
+void afterWorkCallback(uv_work_t *request, int status /*UNUSED*/)
+{
+    HandleScope scope;
+    WorkBaton *work = (WorkBaton*)request->data;
+    const char *errorDescription;
+    Local<Value> args[] = { Local<Value>::New(Null()), Local<Value>::New(Undefined()) };
+    int argc = 1;
+
+    endJob(work);
+
+    if (work->errorCode != 0)
+    {
+        CPhidget_getErrorDescription(work->errorCode, &errorDescription);
+        args[0] = Exception::TypeError(String::New(errorDescription));
+    }
+    else if (work->operation == REMOVE)
+    {
+        unregisterDevice(work->instance, (long)work->handle);
+    }
+    else if (work->operation == CONFIGURE)
+    {
+        int failed;
+        Local<Object> result = configurationResult(*work->configuration, failed);
+
+        // The results also travel with the error, for promise users
+        if (failed != 0)
+        {
+            CPhidget_getErrorDescription(failed, &errorDescription);
+            args[0] = Exception::TypeError(String::New(errorDescription));
+            args[0]->ToObject()->Set(String::NewSymbol("results"), result);
+        }
+
+        args[1] = result;
+        argc = 2;
+    }
+    else if (isRead(work->operation))
+    {
+        args[1] = work->text != NULL ? Local<Value>::New(String::New(work->text)) : Local<Value>::New(Number::New(work->number));
+        argc = 2;
+    }
+
+    if (isRead(work->operation))
+    {
+        std::map<ReadKey, WorkBaton*>::iterator pending = work->instance->pendingReads.find(readKey(work));
+
+        if (pending != work->instance->pendingReads.end() && pending->second == work)
+        {
+            work->instance->pendingReads.erase(pending);
+        }
+    }
+
+    node::MakeCallback(Context::GetCurrent()->Global(), work->callback, argc, args);
+
+    for (size_t n = 0; n < work->waiters.size(); n++)
+    {
+        node::MakeCallback(Context::GetCurrent()->Global(), work->waiters[n], argc, args);
+        work->waiters[n].Dispose();
+    }
+
+    work->callback.Dispose();
+    delete work;
+}
+
+static Handle<Value> queueWork(const Arguments& args, Operations operation, int argumentCount, const char *missingMessage, const char *typeMessage)
+{
+    HandleScope scope;
+
+    if (args.Length() < argumentCount + 1)
+    {
+        ThrowException(Exception::TypeError(String::New(missingMessage)));
+        return scope.Close(Undefined());
+    }
+
+    for (int n = 0; n < argumentCount; n++)
+    {
+        if (!args[n]->IsNumber())
+        {
+            ThrowException(Exception::TypeError(String::New(typeMessage)));
+            return scope.Close(Undefined());
+        }
+    }
+
+    if (!args[argumentCount]->IsFunction())
+    {
+        ThrowException(Exception::TypeError(String::New("Callback argument is not a function")));
+        return scope.Close(Undefined());
+    }
+
+    Instance *instance = unwrapInstance(args);
+    WorkBaton *work = new WorkBaton;
+    work->request.data = work;
+    work->instance = instance;
+    work->operation = operation;
+    work->handle = (CPhidgetHandle)args[0]->IntegerValue();
+    work->argument = argumentCount > 1 ? args[1]->Int32Value() : 0;
+    work->value = argumentCount > 2 ? args[2]->Int32Value() : 0;
+    work->errorCode = 0;
+
+    if (isRead(operation))
+    {
+        std::map<ReadKey, WorkBaton*>::iterator pending = instance->pendingReads.find(readKey(work));
+
+        if (pending != instance->pendingReads.end())
+        {
+            pending->second->waiters.push_back(Persistent<Function>::New(Local<Function>::Cast(args[argumentCount])));
+            delete work;
+            return scope.Close(Undefined());
+        }
+    }
+
+    const char *refused = beginJob(work);
+
+    if (refused != NULL)
+    {
+        delete work;
+        ThrowException(Exception::TypeError(String::New(refused)));
+        return scope.Close(Undefined());
+    }
+
+    work->callback = Persistent<Function>::New(Local<Function>::Cast(args[argumentCount]));
+
+    if (isRead(operation))
+    {
+
+        instance->pendingReads[readKey(work)] = work;
+    }
+    else
+    {
+        // Reads issued after a write must not get an answer from before it
+        forgetReads(instance, (long)work->handle);
+    }
+
+    uv_queue_work(instance->loop, &work->request, workCallback, afterWorkCallback);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> openAsync(const Arguments& args)
+{
+    return queueWork(args, OPEN, 2, "Missing handle, serial number or callback argument", "Handle or serial number argument is not a number");
+}
+
+Handle<Value> waitForAttachmentAsync(const Arguments& args)
+{
+    return queueWork(args, WAIT_FOR_ATTACHMENT, 2, "Missing handle, milliseconds or callback argument", "Handle or milliseconds argument is not a number");
+}
+
+Handle<Value> closeAsync(const Arguments& args)
+{
+    return queueWork(args, CLOSE, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> removeAsync(const Arguments& args)
+{
+    return queueWork(args, REMOVE, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getDeviceNameAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DEVICE_NAME, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getSerialNumberAsync(const Arguments& args)
+{
+    return queueWork(args, GET_SERIAL_NUMBER, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getDeviceVersionAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DEVICE_VERSION, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getDeviceStatusAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DEVICE_STATUS, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getDeviceTypeAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DEVICE_TYPE, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getInputCountAsync(const Arguments& args)
+{
+    return queueWork(args, GET_INPUT_COUNT, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getBridgeValueAsync(const Arguments& args)
+{
+    return queueWork(args, GET_BRIDGE_VALUE, 2, "Missing handle, index or callback argument", "Handle or index argument is not a number");
+}
+
+Handle<Value> getBridgeMaxAsync(const Arguments& args)
+{
+    return queueWork(args, GET_BRIDGE_MAX, 2, "Missing handle, index or callback argument", "Handle or index argument is not a number");
+}
+
+Handle<Value> getBridgeMinAsync(const Arguments& args)
+{
+    return queueWork(args, GET_BRIDGE_MIN, 2, "Missing handle, index or callback argument", "Handle or index argument is not a number");
+}
+
+Handle<Value> getEnabledAsync(const Arguments& args)
+{
+    return queueWork(args, GET_ENABLED, 2, "Missing handle, index or callback argument", "Handle or index argument is not a number");
+}
+
+Handle<Value> setEnabledAsync(const Arguments& args)
+{
+    return queueWork(args, SET_ENABLED, 3, "Missing handle, index, state or callback argument", "Handle, index or state argument is not a number");
+}
+
+Handle<Value> getGainAsync(const Arguments& args)
+{
+    return queueWork(args, GET_GAIN, 2, "Missing handle, index or callback argument", "Handle or index argument is not a number");
+}
+
+Handle<Value> setGainAsync(const Arguments& args)
+{
+    return queueWork(args, SET_GAIN, 3, "Missing handle, index, gain or callback argument", "Handle, index or gain argument is not a number");
+}
+
+Handle<Value> getDataRateAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DATA_RATE, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> setDataRateAsync(const Arguments& args)
+{
+    return queueWork(args, SET_DATA_RATE, 2, "Missing handle, milliseconds or callback argument", "Handle or milliseconds argument is not a number");
+}
+
+Handle<Value> getDataRateMaxAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DATA_RATE_MAX, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+Handle<Value> getDataRateMinAsync(const Arguments& args)
+{
+    return queueWork(args, GET_DATA_RATE_MIN, 1, "Missing handle or callback argument", "Handle argument is not a number");
+}
+
+// Reads an optional numeric field, false when present but not a number
+static bool readSetting(Local<Object> object, const char *name, Setting &setting)
+{
+    Local<Value> value = object->Get(String::NewSymbol(name));
+
+    if (value->IsUndefined() || value->IsNull())
+    {
+        return true;
+    }
+
+    if (!value->IsNumber() && !value->IsBoolean())
+    {
+        return false;
+    }
+
+    setting.requested = true;
+    setting.value = value->Int32Value();
+
+    return true;
+}
+
+Handle<Value> configure(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 3)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle, options or callback argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsObject())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number or options argument is not an object")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[2]->IsFunction())
+    {
+        ThrowException(Exception::TypeError(String::New("Callback argument is not a function")));
+        return scope.Close(Undefined());
+    }
+
+    Local<Object> options = args[1]->ToObject();
+    Local<Value> channels = options->Get(String::NewSymbol("channels"));
+    Configuration *configuration = new Configuration;
+    bool valid = readSetting(options, "dataRate", configuration->dataRate);
+
+    valid = valid && (!configuration->dataRate.requested || configuration->dataRate.value > 0);
+
+    if (valid && channels->IsArray())
+    {
+        Local<Array> list = Local<Array>::Cast(channels);
+
+        configuration->channelCount = list->Length();
+        valid = configuration->channelCount <= MAX_INPUTS;
+
+        for (int index = 0; valid && index < configuration->channelCount; index++)
+        {
+            Local<Value> channel = list->Get(index);
+
+            if (channel->IsUndefined() || channel->IsNull())
+            {
+                continue;
+            }
+
+            Setting &gain = configuration->gains[index];
+
+            valid = channel->IsObject() && readSetting(channel->ToObject(), "gain", gain) && readSetting(channel->ToObject(), "enabled", configuration->enabled[index]);
+            valid = valid && (!gain.requested || (gain.value >= PHIDGET_BRIDGE_GAIN_1 && gain.value <= PHIDGET_BRIDGE_GAIN_128));
+        }
+    }
+    else if (valid && !channels->IsUndefined() && !channels->IsNull())
+    {
+        valid = false;
+    }
+
+    if (!valid)
+    {
+        delete configuration;
+        ThrowException(Exception::TypeError(String::New("Invalid data rate, channel list, gain or enabled option")));
+        return scope.Close(Undefined());
+    }
+
+    WorkBaton *work = new WorkBaton;
+    work->request.data = work;
+    work->instance = unwrapInstance(args);
+    work->operation = CONFIGURE;
+    work->handle = (CPhidgetHandle)args[0]->IntegerValue();
+    work->argument = 0;
+    work->errorCode = 0;
+    work->configuration = configuration;
+
+    const char *refused = beginJob(work);
+
+    if (refused != NULL)
+    {
+        delete work;
+        ThrowException(Exception::TypeError(String::New(refused)));
+        return scope.Close(Undefined());
+    }
+
+    work->callback = Persistent<Function>::New(Local<Function>::Cast(args[2]));
+
+    uv_queue_work(work->instance->loop, &work->request, workCallback, afterWorkCallback);
+
+    return scope.Close(Undefined());
+}
+
+static unsigned int parseStats(Local<Value> value)
+{
+    static const char *names[] = { "min", "max", "mean", "last", "count" };
+    unsigned int mask = 0;
+
+    if (!value->IsArray())
+    {
+        return STAT_ALL;
+    }
+
+    Local<Array> stats = Local<Array>::Cast(value);
+
+    for (uint32_t n = 0; n < stats->Length(); n++)
+    {
+        String::Utf8Value name(stats->Get(n));
+
+        for (unsigned int bit = 0; bit < sizeof(names) / sizeof(names[0]); bit++)
+        {
+            if (strcmp(*name, names[bit]) == 0)
+            {
+                mask |= 1 << bit;
+            }
+        }
+    }
+
+    return mask;
+}
+
+Handle<Value> setAggregation(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    uint64_t window = 0;
+    unsigned int stats = STAT_ALL;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but an options object turns aggregation off
+    if (args.Length() > 2 && args[2]->IsObject())
+    {
+        Local<Object> options = args[2]->ToObject();
+        double windowMs = options->Get(String::NewSymbol("windowMs"))->NumberValue();
+
+        stats = parseStats(options->Get(String::NewSymbol("stats")));
+
+        // Also rejects NaN and Infinity, 1e12 ms is about 30 years and still
+        // fits the nanoseconds in 64 bits
+        if (!(windowMs >= 1 && windowMs <= 1e12))
+        {
+            ThrowException(Exception::TypeError(String::New("Aggregation windowMs is not a number from 1 to 1e12")));
+            return scope.Close(Undefined());
+        }
+
+        if (stats == 0)
+        {
+            ThrowException(Exception::TypeError(String::New("Aggregation needs at least one known stat")));
+            return scope.Close(Undefined());
+        }
+
+        window = (uint64_t)(windowMs * 1e6);
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].aggregator.configure(window, stats);
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+static int parseEdge(Local<Value> value)
+{
+    if (value->IsUndefined())
+    {
+        return EDGE_RISING;
+    }
+
+    String::Utf8Value name(value);
+
+    if (strcmp(*name, "rising") == 0)
+    {
+        return EDGE_RISING;
+    }
+
+    if (strcmp(*name, "falling") == 0)
+    {
+        return EDGE_FALLING;
+    }
+
+    if (strcmp(*name, "both") == 0)
+    {
+        return EDGE_BOTH;
+    }
+
+    return 0;
+}
+
+Handle<Value> setTriggers(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    TriggerSet triggers;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but an array removes the triggers of the channel
+    if (args.Length() > 2 && args[2]->IsArray())
+    {
+        Local<Array> list = Local<Array>::Cast(args[2]);
+
+        if (list->Length() > MAX_TRIGGERS)
+        {
+            ThrowException(Exception::TypeError(String::New("At most 4 triggers per channel are supported")));
+            return scope.Close(Undefined());
+        }
+
+        for (uint32_t n = 0; n < list->Length(); n++)
+        {
+            if (!list->Get(n)->IsObject())
+            {
+                ThrowException(Exception::TypeError(String::New("Trigger is not an object")));
+                return scope.Close(Undefined());
+            }
+
+            Local<Object> options = list->Get(n)->ToObject();
+            Local<Value> threshold = options->Get(String::NewSymbol("threshold"));
+            Local<Value> hysteresis = options->Get(String::NewSymbol("hysteresis"));
+            Local<Value> dwell = options->Get(String::NewSymbol("dwellMs"));
+            int edges = parseEdge(options->Get(String::NewSymbol("edge")));
+
+            if (!threshold->IsNumber() || !std::isfinite(threshold->NumberValue()))
+            {
+                ThrowException(Exception::TypeError(String::New("Trigger threshold is not a finite number")));
+                return scope.Close(Undefined());
+            }
+
+            if (edges == 0)
+            {
+                ThrowException(Exception::TypeError(String::New("Trigger edge must be rising, falling or both")));
+                return scope.Close(Undefined());
+            }
+
+            double hysteresisValue = hysteresis->IsUndefined() ? 0 : hysteresis->NumberValue();
+            double dwellMs = dwell->IsUndefined() ? 0 : dwell->NumberValue();
+
+            // Also rejects NaN, Infinity and values given as anything but a
+            // number, dwellMs is limited to what fits in 64 bits as ns
+            if ((!hysteresis->IsUndefined() && !hysteresis->IsNumber()) || (!dwell->IsUndefined() && !dwell->IsNumber()) ||
+                !(hysteresisValue >= 0 && std::isfinite(hysteresisValue)) || !(dwellMs >= 0 && dwellMs <= 1e12))
+            {
+                ThrowException(Exception::TypeError(String::New("Trigger hysteresis and dwellMs must be finite numbers, not negative")));
+                return scope.Close(Undefined());
+            }
+
+            triggers.add()->configure(threshold->NumberValue(), hysteresisValue, (uint64_t)(dwellMs * 1e6), edges);
+        }
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].triggers = triggers;
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+// Holds back the data events of a device, at most depth of them are kept
+// and the queue policy decides what happens to the rest
+Handle<Value> pauseDevice(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or depth argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or depth argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int64_t depth = args[1]->IntegerValue();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (depth < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Depth must be at least 1")));
+        return scope.Close(Undefined());
+    }
+
+    // The deepest limit asked for, so no consumer gets fewer samples kept
+    // for it than it asked for
+    if ((size_t)depth > device->pausedDepth.load(std::memory_order_relaxed))
+    {
+        device->pausedDepth.store((size_t)depth, std::memory_order_relaxed);
+    }
+
+    device->pauses++;
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> resumeDevice(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (device->pauses == 0 || --device->pauses != 0)
+    {
+        return scope.Close(Undefined());
+    }
+
+    if (device->pausedDepth.exchange(0, std::memory_order_relaxed) != 0)
+    {
+        // Samples coalesced while paused were skipped by earlier drains
+        instance->coalescePending.store(true, std::memory_order_release);
+        uv_async_send(&instance->async);
+    }
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> setDataEvents(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 3)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle, index or enabled argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].dataEvents = args[2]->BooleanValue();
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+// Reads an array of numbers into values, returns the count or -1 if the
+// value is not an array of at most maxCount numbers.
+static int readNumbers(Local<Value> value, double *values, int maxCount)
+{
+    if (!value->IsArray())
+    {
+        return -1;
+    }
+
+    Local<Array> array = Local<Array>::Cast(value);
+
+    if ((int)array->Length() > maxCount)
+    {
+        return -1;
+    }
+
+    for (uint32_t n = 0; n < array->Length(); n++)
+    {
+        Local<Value> element = array->Get(n);
+
+        if (!element->IsNumber())
+        {
+            return -1;
+        }
+
+        values[n] = element->NumberValue();
+    }
+
+    return array->Length();
+}
+
+Handle<Value> setChannelStats(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    bool enable = false;
+    double alpha = 0;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but an options object stops collecting
+    if (args.Length() > 2 && args[2]->IsObject())
+    {
+        Local<Value> value = args[2]->ToObject()->Get(String::NewSymbol("alpha"));
+
+        enable = true;
+        alpha = value->IsUndefined() ? 0 : value->NumberValue();
+
+        if (!(alpha >= 0 && alpha <= 1))
+        {
+            ThrowException(Exception::TypeError(String::New("Alpha must be between 0 and 1")));
+            return scope.Close(Undefined());
+        }
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].stats.configure(enable, alpha, uv_hrtime());
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> getChannelStats(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    void *data;
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    bool reset = args.Length() > 1 && args[1]->BooleanValue();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    Local<Object> result = newTypedArray("Float64Array", MAX_INPUTS * CHANNEL_STATS_FIELDS, &data);
+    double *values = (double*)data;
+    uint64_t now = uv_hrtime();
+
+    uv_mutex_lock(&device->mutex);
+
+    for (int n = 0; n < MAX_INPUTS; n++)
+    {
+        RunningStats &stats = device->channels[n].stats;
+
+        if (!stats.enabled())
+        {
+            std::fill(values + n * CHANNEL_STATS_FIELDS, values + (n + 1) * CHANNEL_STATS_FIELDS, NAN);
+            values[n * CHANNEL_STATS_FIELDS + CHANNEL_COUNT] = 0;
+            continue;
+        }
+
+        stats.read(values + n * CHANNEL_STATS_FIELDS);
+
+        if (reset)
+        {
+            stats.reset(now);
+        }
+    }
+
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(result);
+}
+
+Handle<Value> setFrameMode(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    unsigned int channels = 0;
+    bool batch = false;
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but an options object goes back to data events
+    if (args.Length() > 1 && args[1]->IsObject())
+    {
+        Local<Object> options = args[1]->ToObject();
+        Local<Value> value = options->Get(String::NewSymbol("channels"));
+
+        batch = options->Get(String::NewSymbol("batch"))->BooleanValue();
+
+        if (value->IsUndefined())
+        {
+            // The inputs enabled right now
+            int count = 0, state;
+
+            CPhidgetBridge_getInputCount((CPhidgetBridgeHandle)device->handle, &count);
+
+            for (int n = 0; n < count && n < MAX_INPUTS; n++)
+            {
+                if (CPhidgetBridge_getEnabled((CPhidgetBridgeHandle)device->handle, n, &state) == 0 && state != 0)
+                {
+                    channels |= 1 << n;
+                }
+            }
+        }
+        else
+        {
+            double indices[MAX_INPUTS];
+            int count = readNumbers(value, indices, MAX_INPUTS);
+
+            for (int n = 0; n < count; n++)
+            {
+                if (indices[n] < 0 || indices[n] >= MAX_INPUTS)
+                {
+                    count = -1;
+                    break;
+                }
+
+                channels |= 1 << (int)indices[n];
+            }
+
+            if (count < 0)
+            {
+                ThrowException(Exception::TypeError(String::New("Channels must be an array of input indices")));
+                return scope.Close(Undefined());
+            }
+        }
+
+        if (channels == 0)
+        {
+            ThrowException(Exception::TypeError(String::New("Frame mode needs at least one channel")));
+            return scope.Close(Undefined());
+        }
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->frames.configure(channels, batch);
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+// Fills stage from its options, returns an error message or NULL
+static const char *parseFilter(Device *device, Local<Object> options, FilterStage *stage)
+{
+    String::Utf8Value type(options->Get(String::NewSymbol("type")));
+
+    if (strcmp(*type, "average") == 0 || strcmp(*type, "median") == 0)
+    {
+        bool median = strcmp(*type, "median") == 0;
+        int window = options->Get(String::NewSymbol("window"))->Int32Value();
+
+        if (window < 1 || window > (median ? MAX_MEDIAN_WINDOW : MAX_AVERAGE_WINDOW))
+        {
+            return median ? "Median window must be 1 to 15 samples" : "Average window must be 1 to 256 samples";
+        }
+
+        if (median)
+        {
+            stage->median(window);
+        }
+        else
+        {
+            stage->average(window);
+        }
+
+        return NULL;
+    }
+
+    if (strcmp(*type, "lowpass") == 0)
+    {
+        Local<Value> value = options->Get(String::NewSymbol("order"));
+        Local<Value> sampleRate = options->Get(String::NewSymbol("sampleRateHz"));
+        double cutoff = options->Get(String::NewSymbol("cutoffHz"))->NumberValue();
+        int order = value->IsUndefined() ? 2 : value->Int32Value();
+        double rate;
+
+        if (order < 2 || order > MAX_BIQUAD_SECTIONS * 2 || order % 2 != 0)
+        {
+            return "Low-pass order must be 2, 4, 6 or 8";
+        }
+
+        // Defaults to the data rate the bridge is set to
+        if (sampleRate->IsUndefined())
+        {
+            int milliseconds = 0;
+
+            CPhidgetBridge_getDataRate((CPhidgetBridgeHandle)device->handle, &milliseconds);
+            rate = milliseconds > 0 ? 1000.0 / milliseconds : 0;
+        }
+        else
+        {
+            rate = sampleRate->NumberValue();
+        }
+
+        if (!(rate > 0) || !(cutoff > 0) || cutoff >= rate / 2)
+        {
+            return "Low-pass needs a known sample rate and a cutoffHz below half of it";
+        }
+
+        stage->lowPass(cutoff, rate, order / 2);
+
+        return NULL;
+    }
+
+    if (strcmp(*type, "biquad") == 0)
+    {
+        Local<Value> value = options->Get(String::NewSymbol("sections"));
+        double coefficients[MAX_BIQUAD_SECTIONS * 5];
+        int sections = value->IsArray() ? Local<Array>::Cast(value)->Length() : 0;
+
+        if (sections < 1 || sections > MAX_BIQUAD_SECTIONS)
+        {
+            return "Biquad needs 1 to 4 sections of [b0, b1, b2, a1, a2]";
+        }
+
+        for (int n = 0; n < sections; n++)
+        {
+            if (readNumbers(Local<Array>::Cast(value)->Get(n), coefficients + n * 5, 5) != 5)
+            {
+                return "Biquad needs 1 to 4 sections of [b0, b1, b2, a1, a2]";
+            }
+        }
+
+        stage->biquad(coefficients, sections);
+
+        return NULL;
+    }
+
+    return "Filter type must be average, median, lowpass or biquad";
+}
+
+Handle<Value> setFilters(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    FilterChain filters;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but an array removes the filters of the channel
+    if (args.Length() > 2 && args[2]->IsArray())
+    {
+        Local<Array> list = Local<Array>::Cast(args[2]);
+
+        if (list->Length() > MAX_FILTER_STAGES)
+        {
+            ThrowException(Exception::TypeError(String::New("At most 4 filters per channel are supported")));
+            return scope.Close(Undefined());
+        }
+
+        for (uint32_t n = 0; n < list->Length(); n++)
+        {
+            const char *error;
+
+            if (!list->Get(n)->IsObject())
+            {
+                ThrowException(Exception::TypeError(String::New("Filter is not an object")));
+                return scope.Close(Undefined());
+            }
+
+            if ((error = parseFilter(device, list->Get(n)->ToObject(), filters.add())) != NULL)
+            {
+                ThrowException(Exception::TypeError(String::New(error)));
+                return scope.Close(Undefined());
+            }
+        }
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].filters = filters;
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> setCalibration(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    double offset = 0, gain = 1;
+    double polynomial[MAX_POLYNOMIAL_TERMS], tableX[MAX_TABLE_POINTS], tableY[MAX_TABLE_POINTS];
+    int terms = 0, points = 0;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    // Anything but a profile object resets the channel to raw values
+    if (args.Length() > 2 && args[2]->IsObject())
+    {
+        Local<Object> profile = args[2]->ToObject();
+        Local<Value> value;
+
+        value = profile->Get(String::NewSymbol("offset"));
+        offset = value->IsUndefined() ? 0 : value->NumberValue();
+
+        value = profile->Get(String::NewSymbol("gain"));
+        gain = value->IsUndefined() ? 1 : value->NumberValue();
+
+        value = profile->Get(String::NewSymbol("polynomial"));
+
+        if (!value->IsUndefined() && (terms = readNumbers(value, polynomial, MAX_POLYNOMIAL_TERMS)) < 0)
+        {
+            ThrowException(Exception::TypeError(String::New("Polynomial must be an array of at most 8 coefficients")));
+            return scope.Close(Undefined());
+        }
+
+        value = profile->Get(String::NewSymbol("table"));
+
+        if (!value->IsUndefined())
+        {
+            if (!value->IsArray() || Local<Array>::Cast(value)->Length() < 2 || Local<Array>::Cast(value)->Length() > MAX_TABLE_POINTS)
+            {
+                ThrowException(Exception::TypeError(String::New("Table must be an array of 2 to 32 [x, y] points")));
+                return scope.Close(Undefined());
+            }
+
+            Local<Array> table = Local<Array>::Cast(value);
+            points = table->Length();
+
+            for (int n = 0; n < points; n++)
+            {
+                double point[2];
+
+                if (readNumbers(table->Get(n), point, 2) != 2 || (n > 0 && point[0] <= tableX[n - 1]))
+                {
+                    ThrowException(Exception::TypeError(String::New("Table points must be [x, y] pairs in increasing x order")));
+                    return scope.Close(Undefined());
+                }
+
+                tableX[n] = point[0];
+                tableY[n] = point[1];
+            }
+        }
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].calibration.configure(offset, gain, polynomial, terms, tableX, tableY, points);
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> tare(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 4)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle, index, samples or callback argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle, index or samples argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[3]->IsFunction())
+    {
+        ThrowException(Exception::TypeError(String::New("Callback argument is not a function")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+    int samples = args[2]->Int32Value();
+    std::pair<long, int> key = std::make_pair((long)args[0]->IntegerValue(), index);
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS || samples < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Index or samples argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    if (instance->tareCallbacks.find(key) != instance->tareCallbacks.end())
+    {
+        ThrowException(Exception::TypeError(String::New("Tare already in progress")));
+        return scope.Close(Undefined());
+    }
+
+    instance->tareCallbacks[key] = Persistent<Function>::New(Local<Function>::Cast(args[3]));
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].calibration.startTare(samples);
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> startRecording(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or path argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsString())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number or path argument is not a string")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    String::Utf8Value path(args[1]);
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (device->recorder != NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Recording already in progress")));
+        return scope.Close(Undefined());
+    }
+
+    Recorder *recorder = new Recorder;
+
+    if (!recorder->start(*path))
+    {
+        delete recorder;
+        ThrowException(Exception::TypeError(String::New("Failed to create recording file")));
+        return scope.Close(Undefined());
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->recorder = recorder;
+    uv_mutex_unlock(&device->mutex);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> stopRecording(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+
+    if (device == NULL || device->recorder == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("No recording in progress")));
+        return scope.Close(Undefined());
+    }
+
+    Recorder *recorder = device->recorder;
+
+    uv_mutex_lock(&device->mutex);
+    device->recorder = NULL;
+    uv_mutex_unlock(&device->mutex);
+
+    recorder->stop();
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("samples"), Number::New(recorder->samplesWritten()));
+    result->Set(String::NewSymbol("dropped"), Number::New(recorder->samplesDropped()));
+
+    bool failed = recorder->writeFailed();
+    delete recorder;
+
+    if (failed)
+    {
+        ThrowException(Exception::TypeError(String::New("Failed to write recording file")));
+        return scope.Close(Undefined());
+    }
+
+    return scope.Close(result);
+}
+
+static void replayClosed(uv_handle_t *handle)
+{
+    delete (ReplayJob*)handle->data;
+}
+
+void replayDone(uv_async_t *handle, int status /*UNUSED*/)
+{
+    HandleScope scope;
+    ReplayJob *job = (ReplayJob*)handle->data;
+    Local<Value> args[] = { Local<Value>::New(Null()), Number::New(job->replay.samplesPlayed()) };
+
+    job->replay.stop();
+
+    if (job->device != NULL)
+    {
+        job->instance->replays.erase((long)job->device->handle);
+    }
+
+    if (job->replay.truncated())
+    {
+        args[0] = Exception::TypeError(String::New("Recording file is truncated"));
+    }
+
+    node::MakeCallback(Context::GetCurrent()->Global(), job->callback, 2, args);
+
+    job->callback.Dispose();
+    uv_close((uv_handle_t*)&job->done, replayClosed);
+}
+
+Handle<Value> replay(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 4)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle, path, speed or callback argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsString() || !args[2]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or speed argument is not a number or path argument is not a string")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[3]->IsFunction())
+    {
+        ThrowException(Exception::TypeError(String::New("Callback argument is not a function")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    String::Utf8Value path(args[1]);
+    double speed = args[2]->NumberValue();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (!(std::isfinite(speed) && speed >= 0))
+    {
+        ThrowException(Exception::TypeError(String::New("Speed argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    if (instance->replays.find((long)device->handle) != instance->replays.end())
+    {
+        ThrowException(Exception::TypeError(String::New("Replay already in progress")));
+        return scope.Close(Undefined());
+    }
+
+    ReplayJob *job = new ReplayJob(instance, device);
+
+    if (!job->replay.open(*path))
+    {
+        delete job;
+        ThrowException(Exception::TypeError(String::New("Failed to open recording file")));
+        return scope.Close(Undefined());
+    }
+
+    job->callback = Persistent<Function>::New(Local<Function>::Cast(args[3]));
+    job->done.data = job;
+    uv_async_init(instance->loop, &job->done, replayDone);
+
+    instance->replays[(long)device->handle] = job;
+    job->replay.start(speed, &job->done);
+
+    return scope.Close(Undefined());
+}
+
+// The callback of the replay is called with the samples played so far
+Handle<Value> stopReplay(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    std::map<long, ReplayJob*>::iterator replay = instance->replays.find((long)args[0]->IntegerValue());
+
+    if (replay == instance->replays.end())
+    {
+        ThrowException(Exception::TypeError(String::New("No replay in progress")));
+        return scope.Close(Undefined());
+    }
+
+    replay->second->replay.stop();
+
+    return scope.Close(Undefined());
+}
+
+// Blocks are allocated and freed here on the JS thread, so the library
+// thread adding samples never has to
+static void refillHistory(Device *device, int index)
+{
+    History &history = device->channels[index].history;
+    HistoryBlock *blocks = NULL, *excess;
+    int missing;
+
+    uv_mutex_lock(&device->mutex);
+    missing = history.missing();
+    excess = history.trim();
+    uv_mutex_unlock(&device->mutex);
+
+    History::release(excess);
+
+    for (int n = 0; n < missing; n++)
+    {
+        HistoryBlock *block = new HistoryBlock;
+
+        block->next = blocks;
+        blocks = block;
+    }
+
+    if (blocks != NULL)
+    {
+        uv_mutex_lock(&device->mutex);
+        history.refill(blocks);
+        uv_mutex_unlock(&device->mutex);
+    }
+}
+
+static void refillHistories(Instance *instance)
+{
+    if (!instance->historyPending.exchange(false, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    for (size_t n = 0; n < instance->deviceOrder.size(); n++)
+    {
+        Device *device = instance->deviceOrder[n];
+
+        for (int index = 0; index < MAX_INPUTS && !device->removed; index++)
+        {
+            // The retention only changes on this thread
+            if (device->channels[index].history.enabled())
+            {
+                refillHistory(device, index);
+            }
+        }
+    }
+}
+
+Handle<Value> setHistory(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 3)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle, index or retention argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle, index or retention argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+    double retentionMs = args[2]->NumberValue();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS || retentionMs < 0)
+    {
+        ThrowException(Exception::TypeError(String::New("Index or retention argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    uv_mutex_lock(&device->mutex);
+    device->channels[index].history.configure((uint64_t)(retentionMs * 1e6));
+    uv_mutex_unlock(&device->mutex);
+
+    refillHistory(device, index);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> getHistory(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    std::vector<double> timestamps, values;
+    void *timestampData, *valueData;
+    uint64_t from = 0, to = ~(uint64_t)0;
+    size_t bytes;
+    unsigned long overwritten, dropped;
+
+    if (args.Length() < 2)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing handle or index argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Handle or index argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    Device *device = findDevice(instance, (long)args[0]->IntegerValue());
+    int index = args[1]->Int32Value();
+
+    if (device == NULL)
+    {
+        ThrowException(Exception::TypeError(String::New("Unknown handle")));
+        return scope.Close(Undefined());
+    }
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        ThrowException(Exception::TypeError(String::New("Index argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    if (args.Length() > 2 && args[2]->IsNumber() && args[2]->NumberValue() > 0)
+    {
+        from = (uint64_t)(args[2]->NumberValue() * 1e6);
+    }
+
+    if (args.Length() > 3 && args[3]->IsNumber())
+    {
+        to = args[3]->NumberValue() > 0 ? (uint64_t)(args[3]->NumberValue() * 1e6) : 0;
+    }
+
+    History &history = device->channels[index].history;
+    HistorySnapshot snapshot;
+
+    // Decoding can take a while, the library thread only waits for the copy
+    // of the newest block
+    uv_mutex_lock(&device->mutex);
+    history.pin(snapshot);
+    bytes = history.bytes();
+    overwritten = history.overwrittenCount();
+    dropped = history.droppedCount();
+    uv_mutex_unlock(&device->mutex);
+
+    snapshot.query(from, to, timestamps, values);
+
+    uv_mutex_lock(&device->mutex);
+    history.unpin();
+    uv_mutex_unlock(&device->mutex);
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("timestamps"), newTypedArray("Float64Array", timestamps.size(), &timestampData));
+    result->Set(String::NewSymbol("values"), newTypedArray("Float64Array", values.size(), &valueData));
+    result->Set(String::NewSymbol("bytes"), Number::New(bytes));
+    result->Set(String::NewSymbol("overwritten"), Number::New(overwritten));
+    result->Set(String::NewSymbol("dropped"), Number::New(dropped));
+
+    if (!timestamps.empty())
+    {
+        memcpy(timestampData, &timestamps[0], timestamps.size() * sizeof(double));
+        memcpy(valueData, &values[0], values.size() * sizeof(double));
+    }
+
+    return scope.Close(result);
+}
+
+// Doubles per snapshot record: handle, index, value, timestamp, stale
+#define SNAPSHOT_RECORD_SIZE 5
+
+Handle<Value> getSnapshot(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    uint64_t staleAfter = 1000000000, now = uv_hrtime();
+    size_t count = 0;
+    void *data;
+
+    if (args.Length() > 0 && args[0]->IsNumber())
+    {
+        staleAfter = (uint64_t)(args[0]->NumberValue() * 1e6);
+    }
+
+    Local<Object> snapshot = newTypedArray("Float64Array", instance->devices.size() * MAX_INPUTS * SNAPSHOT_RECORD_SIZE, &data);
+    double *record = (double*)data;
+
+    for (std::map<long, Device*>::iterator it = instance->devices.begin(); it != instance->devices.end(); ++it)
+    {
+        Device *device = it->second;
+
+        uv_mutex_lock(&device->mutex);
+
+        for (int index = 0; index < MAX_INPUTS; index++)
+        {
+            Channel &channel = device->channels[index];
+
+            if (channel.latestTimestamp == 0)
+            {
+                continue;
+            }
+
+            record[0] = it->first;
+            record[1] = index;
+            record[2] = channel.latest;
+            record[3] = channel.latestTimestamp / 1e6;
+            record[4] = now - channel.latestTimestamp > staleAfter ? 1 : 0;
+            record += SNAPSHOT_RECORD_SIZE;
+            count++;
+        }
+
+        uv_mutex_unlock(&device->mutex);
+    }
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("records"), snapshot);
+    result->Set(String::NewSymbol("count"), Number::New(count));
+    result->Set(String::NewSymbol("recordSize"), Number::New(SNAPSHOT_RECORD_SIZE));
+
+    return scope.Close(result);
+}
+
+Handle<Value> getDroppedEvents(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    return scope.Close(Number::New(instance->eventQueue.dropped()));
+}
+
+Handle<Value> setBatchMode(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing enabled argument")));
+        return scope.Close(Undefined());
+    }
+
+    instance->batchMode = args[0]->BooleanValue();
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> enableSampleBuffer(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    void *header, *records;
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing capacity argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsNumber())
+    {
+        ThrowException(Exception::TypeError(String::New("Capacity argument is not a number")));
+        return scope.Close(Undefined());
+    }
+
+    double requested = args[0]->NumberValue();
+
+    if (!(requested >= 2 && requested <= MAX_SAMPLE_BUFFER_CAPACITY) || requested != floor(requested))
+    {
+        ThrowException(Exception::TypeError(String::New("Capacity argument is out of range")));
+        return scope.Close(Undefined());
+    }
+
+    instance->sampleBufferEvents.store(args.Length() > 1 && args[1]->BooleanValue(), std::memory_order_relaxed);
+
+    // The buffer is shared with producer threads that may be writing at any
+    // time, so it is created once and then lives as long as the process.
+    if (instance->sampleBuffer.load(std::memory_order_acquire) == NULL)
+    {
+        size_t capacity = 2;
+
+        while (capacity < (size_t)requested)
+        {
+            capacity <<= 1;
+        }
+
+        instance->sampleBufferHeader = Persistent<Object>::New(newTypedArray("Float64Array", 1, &header));
+        instance->sampleBufferRecords = Persistent<Object>::New(newTypedArray("Float64Array", capacity * SAMPLE_RECORD_SIZE, &records));
+
+        instance->sampleBuffer.store(new SampleBuffer((double*)header, (double*)records, capacity), std::memory_order_release);
+    }
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("header"), instance->sampleBufferHeader);
+    result->Set(String::NewSymbol("records"), instance->sampleBufferRecords);
+    result->Set(String::NewSymbol("capacity"), Number::New(instance->sampleBuffer.load(std::memory_order_relaxed)->capacity()));
+    result->Set(String::NewSymbol("recordSize"), Number::New(SAMPLE_RECORD_SIZE));
+
+    return scope.Close(result);
+}
+
+// Calls into JS without the tick processing node::MakeCallback does after
+// every call, the drain does that once when it is done.
+static void callFunction(Handle<Object> receiver, Handle<Function> function, int argc, Handle<Value> argv[])
+{
+    TryCatch tryCatch;
+
+    function->Call(receiver, argc, argv);
+
+    if (tryCatch.HasCaught())
+    {
+        node::FatalException(tryCatch);
+    }
+}
+
+static void emitEvent(Instance *instance, int argc, Handle<Value> argv[])
+{
+    if (!instance->emit.IsEmpty())
+    {
+        callFunction(instance->emitter, instance->emit, argc, argv);
+    }
+}
+
+static Local<String> errorString(Instance *instance, const char *text)
+{
+    std::map<std::string, Persistent<String> >::iterator it = instance->errorStrings.find(text);
+
+    if (it != instance->errorStrings.end())
+    {
+        return Local<String>::New(it->second);
+    }
+
+    Local<String> string = String::New(text);
+
+    if (instance->errorStrings.size() < ERROR_STRING_CACHE)
+    {
+        instance->errorStrings[text] = Persistent<String>::New(string);
+    }
+
+    return string;
+}
+
+static void flushDataBatch(Instance *instance)
+{
+    size_t count = instance->dataBatch.values.size();
+    void *handles, *indices, *values, *timestamps;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    Local<Value> args[] = {
+        Local<Value>::New(instance->symbols.dataBatch),
+        newTypedArray("Float64Array", count, &handles),
+        newTypedArray("Uint8Array", count, &indices),
+        newTypedArray("Float64Array", count, &values),
+        newTypedArray("Float64Array", count, &timestamps)
+    };
+
+    memcpy(handles, &instance->dataBatch.handles[0], count * sizeof(double));
+    memcpy(indices, &instance->dataBatch.indices[0], count * sizeof(unsigned char));
+    memcpy(values, &instance->dataBatch.values[0], count * sizeof(double));
+    memcpy(timestamps, &instance->dataBatch.timestamps[0], count * sizeof(double));
+
+    instance->dataBatch.handles.clear();
+    instance->dataBatch.indices.clear();
+    instance->dataBatch.values.clear();
+    instance->dataBatch.timestamps.clear();
+
+    emitEvent(instance, 5, args);
+}
+
+// Emits the frames each device collected during the drain
+static void flushFrameBatches(Instance *instance)
+{
+    for (size_t i = 0; i < instance->deviceOrder.size(); i++)
+    {
+        Device *device = instance->deviceOrder[i];
+        FrameBatch &batch = device->frameBatch;
+        size_t count = batch.timestamps.size();
+        void *timestamps, *masks, *values;
+
+        if (count == 0 || device->removed)
+        {
+            continue;
+        }
+
+        Local<Value> args[] = {
+            Local<Value>::New(instance->symbols.frameBatch),
+            Number::New((long)device->handle),
+            newTypedArray("Float64Array", count, &timestamps),
+            newTypedArray("Uint8Array", count, &masks),
+            newTypedArray("Float64Array", batch.values.size(), &values)
+        };
+
+        memcpy(timestamps, &batch.timestamps[0], count * sizeof(double));
+        memcpy(masks, &batch.masks[0], count * sizeof(unsigned char));
+        memcpy(values, &batch.values[0], batch.values.size() * sizeof(double));
+
+        batch.timestamps.clear();
+        batch.masks.clear();
+        batch.values.clear();
+
+        emitEvent(instance, 5, args);
+    }
+}
+
+static Local<Object> describePool(const Pool<Baton> &pool)
+{
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("capacity"), Number::New(pool.capacity()));
+    result->Set(String::NewSymbol("inUse"), Number::New(pool.inUse()));
+    result->Set(String::NewSymbol("highWater"), Number::New(pool.peakInUse()));
+    result->Set(String::NewSymbol("exhausted"), Number::New(pool.exhaustedCount()));
+
+    return result;
+}
+
+Handle<Value> getPoolStats(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    Local<Object> result = describePool(instance->eventQueue.pool);
+    result->Set(String::NewSymbol("control"), describePool(instance->eventQueue.controlPool));
+
+    return scope.Close(result);
+}
+
+static Local<Object> summarize(const Histogram &histogram, double scale)
+{
+    Local<Object> result = Object::New();
+
+    result->Set(String::NewSymbol("count"), Number::New(histogram.count()));
+    result->Set(String::NewSymbol("min"), Number::New(histogram.min() * scale));
+    result->Set(String::NewSymbol("mean"), Number::New(histogram.mean() * scale));
+    result->Set(String::NewSymbol("p50"), Number::New(histogram.percentile(0.5) * scale));
+    result->Set(String::NewSymbol("p90"), Number::New(histogram.percentile(0.9) * scale));
+    result->Set(String::NewSymbol("p99"), Number::New(histogram.percentile(0.99) * scale));
+    result->Set(String::NewSymbol("p999"), Number::New(histogram.percentile(0.999) * scale));
+    result->Set(String::NewSymbol("max"), Number::New(histogram.max() * scale));
+
+    return result;
+}
+
+Handle<Value> getStats(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    Local<Object> events = Object::New();
+    Local<Object> latency = Object::New();
+
+    for (int n = 0; n < EVENT_TYPES; n++)
+    {
+        events->Set(String::NewSymbol(eventNames[n]), Number::New(instance->pipelineStats.events[n]));
+        latency->Set(String::NewSymbol(eventNames[n]), summarize(instance->pipelineStats.latency[n], 1e-6));
+    }
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("events"), events);
+    result->Set(String::NewSymbol("latency"), latency);
+    result->Set(String::NewSymbol("drains"), Number::New(instance->pipelineStats.drains));
+    result->Set(String::NewSymbol("eventsPerDrain"), summarize(instance->pipelineStats.eventsPerDrain, 1));
+    result->Set(String::NewSymbol("drainDuration"), summarize(instance->pipelineStats.drainDuration, 1e-6));
+    result->Set(String::NewSymbol("maxQueueDepth"), Number::New(instance->pipelineStats.maxQueueDepth));
+    result->Set(String::NewSymbol("queueDepth"), Number::New(queuedData(instance) + instance->eventQueue.control.size()));
+    result->Set(String::NewSymbol("dropped"), Number::New(instance->eventQueue.dropped()));
+
+    if (args.Length() > 0 && args[0]->BooleanValue())
+    {
+        instance->pipelineStats.reset();
+    }
+
+    return scope.Close(result);
+}
+
+static const char *policyNames[] = { "dropNewest", "dropOldest", "coalesce" };
+
+Handle<Value> setQueueOptions(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+    size_t maxDepth = instance->eventQueue.maxDepth();
+    QueuePolicies policy = instance->eventQueue.policy();
+
+    if (args.Length() < 1 || !args[0]->IsObject())
+    {
+        ThrowException(Exception::TypeError(String::New("Missing options argument")));
+        return scope.Close(Undefined());
+    }
+
+    Local<Object> options = args[0]->ToObject();
+    Local<Value> value = options->Get(String::NewSymbol("maxDepth"));
+
+    if (!value->IsUndefined())
+    {
+        if (!value->IsNumber() || value->IntegerValue() < 1)
+        {
+            ThrowException(Exception::TypeError(String::New("maxDepth must be a positive number")));
+            return scope.Close(Undefined());
+        }
+
+        maxDepth = value->IntegerValue();
+    }
+
+    value = options->Get(String::NewSymbol("policy"));
+
+    if (!value->IsUndefined())
+    {
+        String::Utf8Value name(value);
+        unsigned int n;
+
+        for (n = 0; n < sizeof(policyNames) / sizeof(policyNames[0]); n++)
+        {
+            if (strcmp(*name, policyNames[n]) == 0)
+            {
+                policy = (QueuePolicies)n;
+                break;
+            }
+        }
+
+        if (n == sizeof(policyNames) / sizeof(policyNames[0]))
+        {
+            ThrowException(Exception::TypeError(String::New("Policy must be dropNewest, dropOldest or coalesce")));
+            return scope.Close(Undefined());
+        }
+    }
+
+    instance->eventQueue.configure(maxDepth, policy);
+
+    return scope.Close(Undefined());
+}
+
+Handle<Value> getQueueStats(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("depth"), Number::New(queuedData(instance)));
+    result->Set(String::NewSymbol("controlDepth"), Number::New(instance->eventQueue.control.size()));
+    result->Set(String::NewSymbol("maxDepth"), Number::New(instance->eventQueue.maxDepth()));
+    result->Set(String::NewSymbol("capacity"), Number::New(instance->eventQueue.dataCapacity()));
+    result->Set(String::NewSymbol("policy"), String::New(policyNames[instance->eventQueue.policy()]));
+    result->Set(String::NewSymbol("droppedNewest"), Number::New(instance->eventQueue.droppedNewestCount()));
+    result->Set(String::NewSymbol("droppedOldest"), Number::New(instance->eventQueue.droppedOldestCount()));
+    result->Set(String::NewSymbol("coalesced"), Number::New(instance->eventQueue.coalescedCount()));
+    result->Set(String::NewSymbol("droppedControl"), Number::New(instance->eventQueue.droppedControlCount()));
+    result->Set(String::NewSymbol("poolExhausted"), Number::New(instance->eventQueue.pool.exhaustedCount() +
+                                                                    instance->eventQueue.controlPool.exhaustedCount()));
+
+    return scope.Close(result);
+}
+
+Handle<Value> setEmitter(const Arguments& args)
+{
+    HandleScope scope;
+    Instance *instance = unwrapInstance(args);
+
+    if (args.Length() < 1)
+    {
+        ThrowException(Exception::TypeError(String::New("Missing emitter argument")));
+        return scope.Close(Undefined());
+    }
+
+    if (!args[0]->IsObject() || !args[0]->ToObject()->Get(String::NewSymbol("emit"))->IsFunction())
+    {
+        ThrowException(Exception::TypeError(String::New("Emitter argument has no emit function")));
+        return scope.Close(Undefined());
+    }
+
+    Local<Object> emitter = args[0]->ToObject();
+
+    instance->emitter.Dispose();
+    instance->emit.Dispose();
+    instance->emitter = Persistent<Object>::New(emitter);
+    instance->emit = Persistent<Function>::New(Local<Function>::Cast(emitter->Get(String::NewSymbol("emit"))));
+
+    return scope.Close(Undefined());
+}
+
+static void dispatchBaton(Instance *instance, Baton *baton)
+{
+    uint64_t latency = uv_hrtime() - baton->timestamp;
+
+    TRACE_DISPATCH(baton->handle, baton->index, (int)baton->event, latency);
+
+    instance->pipelineStats.events[baton->event]++;
+    instance->pipelineStats.latency[baton->event].record(latency);
+
+    Device *device = NULL;
+
+    if (baton->event == FRAME)
+    {
+        if ((device = findDevice(instance, baton->handle)) == NULL)
+        {
+            return;
+        }
+
+        if (device->frames.batched)
+        {
+            Frame &frame = baton->frame;
+
+            device->frameBatch.timestamps.push_back(frame.timestamp / 1e6);
+            device->frameBatch.masks.push_back(frame.mask);
+
+            // Channels missing from a frame are NaN
+            for (int n = 0; n < device->frames.width; n++)
+            {
+                device->frameBatch.values.push_back(frame.mask & (1 << n) ? frame.values[n] : NAN);
+            }
+
+            return;
+        }
+    }
+
+    if (baton->event == DATA && instance->batchMode)
+    {
+        instance->dataBatch.handles.push_back(baton->handle);
+        instance->dataBatch.indices.push_back(baton->index);
+        instance->dataBatch.values.push_back(baton->value);
+        instance->dataBatch.timestamps.push_back(baton->timestamp / 1e6);
+        return;
+    }
+
+    // Keep samples ordered relative to attach, detach and error events.
+    flushDataBatch(instance);
+    flushFrameBatches(instance);
+
+    switch (baton->event)
+    {
+        case ATTACH:
+        {
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[ATTACH]), Number::New(baton->handle) };
+            emitEvent(instance, 2, args);
+            break;
+        }
+        case DETACH:
+        {
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[DETACH]), Number::New(baton->handle) };
+            emitEvent(instance, 2, args);
+            break;
+        }
+        case ERROR:
+        {
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[ERROR]), Number::New(baton->handle), errorString(instance, baton->errorString) };
+            emitEvent(instance, 3, args);
+            break;
+        }
+        case DATA:
+        {
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[DATA]), Number::New(baton->handle), Number::New(baton->index), Number::New(baton->value), Number::New(baton->timestamp / 1e6) };
+            emitEvent(instance, 5, args);
+            break;
+        }
+        case AGGREGATE:
+        {
+            Aggregate &aggregate = baton->aggregate;
+            unsigned int stats = aggregate.stats;
+            Local<Object> result = Object::New();
+
+            if (stats & STAT_MIN)
+            {
+                result->Set(instance->symbols.min, Number::New(aggregate.min));
+            }
+
+            if (stats & STAT_MAX)
+            {
+                result->Set(instance->symbols.max, Number::New(aggregate.max));
+            }
+
+            if (stats & STAT_MEAN)
+            {
+                result->Set(instance->symbols.mean, Number::New(aggregate.mean));
+            }
+
+            if (stats & STAT_LAST)
+            {
+                result->Set(instance->symbols.last, Number::New(aggregate.last));
+            }
+
+            if (stats & STAT_COUNT)
+            {
+                result->Set(instance->symbols.count, Number::New(aggregate.count));
+            }
+
+            result->Set(instance->symbols.start, Number::New(aggregate.start / 1e6));
+            result->Set(instance->symbols.end, Number::New(aggregate.end / 1e6));
+
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[AGGREGATE]), Number::New(baton->handle), Number::New(baton->index), result };
+            emitEvent(instance, 4, args);
+            break;
+        }
+        case TRIGGER:
+        {
+            Local<Object> result = Object::New();
+
+            result->Set(instance->symbols.trigger, Number::New(baton->crossing.trigger));
+            result->Set(instance->symbols.edge, Local<Value>::New(baton->crossing.rising ? instance->symbols.rising : instance->symbols.falling));
+            result->Set(instance->symbols.value, Number::New(baton->value));
+            result->Set(instance->symbols.timestamp, Number::New(baton->crossing.timestamp / 1e6));
+
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[TRIGGER]), Number::New(baton->handle), Number::New(baton->index), result };
+            emitEvent(instance, 4, args);
+            break;
+        }
+        case FRAME:
+        {
+            Frame &frame = baton->frame;
+            void *data;
+            Local<Object> values = newTypedArray("Float64Array", device->frames.width, &data);
+
+            for (int n = 0; n < device->frames.width; n++)
+            {
+                ((double*)data)[n] = frame.mask & (1 << n) ? frame.values[n] : NAN;
+            }
+
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[FRAME]), Number::New(baton->handle), Number::New(frame.timestamp / 1e6), Number::New(frame.mask), values };
+            emitEvent(instance, 5, args);
+            break;
+        }
+        case MANAGER_ATTACH:
+        case MANAGER_DETACH:
+        {
+            Local<Value> args[] = { Local<Value>::New(instance->symbols.events[baton->event]), Number::New(baton->serialNumber) };
+            emitEvent(instance, 2, args);
+            break;
+        }
+        case TARE:
+        {
+            std::map<std::pair<long, int>, Persistent<Function> >::iterator callback = instance->tareCallbacks.find(std::make_pair(baton->handle, baton->index));
+
+            if (callback != instance->tareCallbacks.end())
+            {
+                Persistent<Function> function = callback->second;
+                Local<Value> args[] = { Local<Value>::New(Null()), Number::New(baton->value) };
+
+                instance->tareCallbacks.erase(callback);
+                callFunction(Context::GetCurrent()->Global(), function, 2, args);
+                function.Dispose();
+            }
+
+            break;
+        }
+    }
+}
+
+// Delivers the samples held back by the coalesce policy. They were newer
+// than anything in the queue when they were held back, but samples queued
+// since may have been delivered already, a held back sample older than
+// those is dropped to keep the channel in order.
+static void dispatchCoalesced(Instance *instance)
+{
+    Baton baton;
+
+    if (!instance->coalescePending.exchange(false, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    baton.event = DATA;
+
+    // Indexed, callbacks may create instance->devices while we iterate
+    for (size_t n = 0; n < instance->deviceOrder.size(); n++)
+    {
+        Device *device = instance->deviceOrder[n];
+
+        // Picked up again when the device is resumed
+        if (device->pausedDepth.load(std::memory_order_relaxed) != 0)
+        {
+            continue;
+        }
+
+        for (int index = 0; index < MAX_INPUTS && !device->removed; index++)
+        {
+            Channel &channel = device->channels[index];
+            bool coalesced;
+
+            uv_mutex_lock(&device->mutex);
+            coalesced = channel.coalesced;
+            baton.value = channel.coalescedValue;
+            baton.timestamp = channel.coalescedTimestamp;
+            channel.coalesced = false;
+            uv_mutex_unlock(&device->mutex);
+
+            if (coalesced && baton.timestamp <= channel.deliveredTimestamp)
+            {
+                instance->eventQueue.countCoalesced();
+            }
+            else if (coalesced)
+            {
+                channel.deliveredTimestamp = baton.timestamp;
+                baton.handle = (long)device->handle;
+                baton.index = index;
+                dispatchBaton(instance, &baton);
+            }
+        }
+    }
+}
+
+static Baton *nextBaton(Ring<Baton*> &ring, size_t &pending)
+{
+    Baton *baton;
+
+    if (pending == 0 || !ring.pop(baton))
+    {
+        pending = 0;
+        return NULL;
+    }
+
+    pending--;
+
+    return baton;
+}
+
+static void dispatchControl(Instance *instance)
+{
+    size_t pending = instance->eventQueue.control.size();
+    Baton *baton;
+
+    while ((baton = nextBaton(instance->eventQueue.control, pending)) != NULL)
+    {
+        dispatchBaton(instance, baton);
+        instance->eventQueue.release(baton);
+    }
+}
+
+void eventCallback(uv_async_t *handle, int status /*UNUSED*/)
+{
+    HandleScope scope;
+    Instance *instance = (Instance*)handle->data;
+    uint64_t start = uv_hrtime();
+    size_t count = instance->deviceOrder.size();
+    size_t depth = instance->eventQueue.control.size();
+    bool progress = true;
+
+    TRACE_WAKEUP(depth);
+
+    instance->draining = true;
+
+    // Only drain what was queued when we started, producers keep running
+    // while JS executes and we must not starve the rest of the loop. Paused
+    // devices keep their events until they are resumed.
+    instance->drainPending.resize(count);
+
+    for (size_t n = 0; n < count; n++)
+    {
+        Device *device = instance->deviceOrder[n];
+
+        instance->drainPending[n] = device->pausedDepth.load(std::memory_order_relaxed) == 0 ? device->events.size() : 0;
+        depth += instance->drainPending[n];
+    }
+
+    TRACE_DRAIN_START(depth, count);
+
+    if (count > 0)
+    {
+        instance->drainStart = (instance->drainStart + 1) % count;
+    }
+
+    // Control events go first, then the instance->devices take turns so a busy one
+    // cannot hold back the others. Control events that arrive meanwhile
+    // are picked up between the rounds.
+    while (progress)
+    {
+        progress = false;
+
+        dispatchControl(instance);
+
+        for (size_t n = 0; n < count; n++)
+        {
+            size_t i = (instance->drainStart + n) % count;
+            Device *device = instance->deviceOrder[i];
+            Baton *baton;
+
+            for (int quantum = 0; quantum < DRAIN_QUANTUM; quantum++)
+            {
+                if ((baton = nextBaton(device->events, instance->drainPending[i])) == NULL)
+                {
+                    break;
+                }
+
+                if (baton->event == DATA && baton->index >= 0 && baton->index < MAX_INPUTS)
+                {
+                    device->channels[baton->index].deliveredTimestamp = baton->timestamp;
+                }
+
+                if (!device->removed)
+                {
+                    dispatchBaton(instance, baton);
+                }
+
+                instance->eventQueue.release(baton);
+                progress = true;
+            }
+        }
+    }
+
+    dispatchCoalesced(instance);
+    refillHistories(instance);
+    flushDataBatch(instance);
+    flushFrameBatches(instance);
+
+    // The one call per drain that goes through node, so process.nextTick
+    // callbacks queued by the handlers run now rather than after every event
+    if (!instance->emit.IsEmpty())
+    {
+        Local<Value> args[] = { Local<Value>::New(instance->symbols.drain) };
+        node::MakeCallback(instance->emitter, instance->emit, 1, args);
+    }
+
+    instance->draining = false;
+
+    for (size_t n = instance->deviceOrder.size(); n > 0; n--)
+    {
+        if (instance->deviceOrder[n - 1]->removed)
+        {
+            releaseDevice(instance->deviceOrder[n - 1]);
+        }
+    }
+
+    uint64_t duration = uv_hrtime() - start;
+
+    TRACE_DRAIN_END(depth, duration);
+
+    instance->pipelineStats.drains++;
+    instance->pipelineStats.eventsPerDrain.record(depth);
+    instance->pipelineStats.drainDuration.record(duration);
+
+    if (depth > instance->pipelineStats.maxQueueDepth)
+    {
+        instance->pipelineStats.maxQueueDepth = depth;
+    }
+
+    if (instance->eventQueue.control.size() > 0 || queuedData(instance, false) > 0)
+    {
+        uv_async_send(&instance->async);
+    }
+}
+
+void init(Handle<Object> target)
+{
+    // The functions find the instance through their data slot. It is bound
+    // to the default loop and lives as long as the process, library threads
+    // may call into it until the very end, so the module can be loaded only
+    // once.
+    static bool loaded = false;
+
+    if (loaded)
+    {
+        ThrowException(Exception::Error(String::New("The module can only be loaded once per process")));
+        return;
+    }
+
+    loaded = true;
+
+    Instance *instance = new Instance(uv_default_loop());
+    Local<External> data = External::New(instance);
+
+    for (int n = 0; n < EVENT_TYPES; n++)
+    {
+        instance->symbols.events[n] = Persistent<String>::New(String::NewSymbol(eventNames[n]));
+    }
+
+    instance->symbols.dataBatch = Persistent<String>::New(String::NewSymbol("dataBatch"));
+    instance->symbols.frameBatch = Persistent<String>::New(String::NewSymbol("frameBatch"));
+    instance->symbols.drain = Persistent<String>::New(String::NewSymbol("drain"));
+    instance->symbols.min = Persistent<String>::New(String::NewSymbol("min"));
+    instance->symbols.max = Persistent<String>::New(String::NewSymbol("max"));
+    instance->symbols.mean = Persistent<String>::New(String::NewSymbol("mean"));
+    instance->symbols.last = Persistent<String>::New(String::NewSymbol("last"));
+    instance->symbols.count = Persistent<String>::New(String::NewSymbol("count"));
+    instance->symbols.start = Persistent<String>::New(String::NewSymbol("start"));
+    instance->symbols.end = Persistent<String>::New(String::NewSymbol("end"));
+    instance->symbols.trigger = Persistent<String>::New(String::NewSymbol("trigger"));
+    instance->symbols.edge = Persistent<String>::New(String::NewSymbol("edge"));
+    instance->symbols.rising = Persistent<String>::New(String::NewSymbol("rising"));
+    instance->symbols.falling = Persistent<String>::New(String::NewSymbol("falling"));
+    instance->symbols.value = Persistent<String>::New(String::NewSymbol("value"));
+    instance->symbols.timestamp = Persistent<String>::New(String::NewSymbol("timestamp"));
+
+    target->Set(String::New("setEmitter"), FunctionTemplate::New(setEmitter, data)->GetFunction());
+    target->Set(String::New("create"), FunctionTemplate::New(create, data)->GetFunction());
+    target->Set(String::New("open"), FunctionTemplate::New(open, data)->GetFunction());
+    target->Set(String::New("openManager"), FunctionTemplate::New(openManager, data)->GetFunction());
+    target->Set(String::New("closeManager"), FunctionTemplate::New(closeManager, data)->GetFunction());
+    target->Set(String::New("waitForAttachment"), FunctionTemplate::New(waitForAttachment, data)->GetFunction());
+    target->Set(String::New("close"), FunctionTemplate::New(close, data)->GetFunction());
+    target->Set(String::New("remove"), FunctionTemplate::New(remove, data)->GetFunction());
+    target->Set(String::New("getDeviceName"), FunctionTemplate::New(getDeviceName, data)->GetFunction());
+    target->Set(String::New("getSerialNumber"), FunctionTemplate::New(getSerialNumber, data)->GetFunction());
+    target->Set(String::New("getDeviceVersion"), FunctionTemplate::New(getDeviceVersion, data)->GetFunction());
+    target->Set(String::New("getDeviceStatus"), FunctionTemplate::New(getDeviceStatus, data)->GetFunction());
+    target->Set(String::New("getLibraryVersion"), FunctionTemplate::New(getLibraryVersion, data)->GetFunction());
+    target->Set(String::New("getDeviceType"), FunctionTemplate::New(getDeviceType, data)->GetFunction());
+    target->Set(String::New("getInputCount"), FunctionTemplate::New(getInputCount, data)->GetFunction());
+    target->Set(String::New("getBridgeValue"), FunctionTemplate::New(getBridgeValue, data)->GetFunction());
+    target->Set(String::New("getBridgeMax"), FunctionTemplate::New(getBridgeMax, data)->GetFunction());
+    target->Set(String::New("getBridgeMin"), FunctionTemplate::New(getBridgeMin, data)->GetFunction());
+    target->Set(String::New("setEnabled"), FunctionTemplate::New(setEnabled, data)->GetFunction());
+    target->Set(String::New("getEnabled"), FunctionTemplate::New(getEnabled, data)->GetFunction());
+    target->Set(String::New("getGain"), FunctionTemplate::New(getGain, data)->GetFunction());
+    target->Set(String::New("setGain"), FunctionTemplate::New(setGain, data)->GetFunction());
+    target->Set(String::New("getDataRate"), FunctionTemplate::New(getDataRate, data)->GetFunction());
+    target->Set(String::New("setDataRate"), FunctionTemplate::New(setDataRate, data)->GetFunction());
+    target->Set(String::New("getDataRateMax"), FunctionTemplate::New(getDataRateMax, data)->GetFunction());
+    target->Set(String::New("getDataRateMin"), FunctionTemplate::New(getDataRateMin, data)->GetFunction());
+    target->Set(String::New("openAsync"), FunctionTemplate::New(openAsync, data)->GetFunction());
+    target->Set(String::New("waitForAttachmentAsync"), FunctionTemplate::New(waitForAttachmentAsync, data)->GetFunction());
+    target->Set(String::New("closeAsync"), FunctionTemplate::New(closeAsync, data)->GetFunction());
+    target->Set(String::New("removeAsync"), FunctionTemplate::New(removeAsync, data)->GetFunction());
+    target->Set(String::New("configure"), FunctionTemplate::New(configure, data)->GetFunction());
+    target->Set(String::New("getDeviceNameAsync"), FunctionTemplate::New(getDeviceNameAsync, data)->GetFunction());
+    target->Set(String::New("getSerialNumberAsync"), FunctionTemplate::New(getSerialNumberAsync, data)->GetFunction());
+    target->Set(String::New("getDeviceVersionAsync"), FunctionTemplate::New(getDeviceVersionAsync, data)->GetFunction());
+    target->Set(String::New("getDeviceStatusAsync"), FunctionTemplate::New(getDeviceStatusAsync, data)->GetFunction());
+    target->Set(String::New("getDeviceTypeAsync"), FunctionTemplate::New(getDeviceTypeAsync, data)->GetFunction());
+    target->Set(String::New("getInputCountAsync"), FunctionTemplate::New(getInputCountAsync, data)->GetFunction());
+    target->Set(String::New("getBridgeValueAsync"), FunctionTemplate::New(getBridgeValueAsync, data)->GetFunction());
+    target->Set(String::New("getBridgeMaxAsync"), FunctionTemplate::New(getBridgeMaxAsync, data)->GetFunction());
+    target->Set(String::New("getBridgeMinAsync"), FunctionTemplate::New(getBridgeMinAsync, data)->GetFunction());
+    target->Set(String::New("getEnabledAsync"), FunctionTemplate::New(getEnabledAsync, data)->GetFunction());
+    target->Set(String::New("setEnabledAsync"), FunctionTemplate::New(setEnabledAsync, data)->GetFunction());
+    target->Set(String::New("getGainAsync"), FunctionTemplate::New(getGainAsync, data)->GetFunction());
+    target->Set(String::New("setGainAsync"), FunctionTemplate::New(setGainAsync, data)->GetFunction());
+    target->Set(String::New("getDataRateAsync"), FunctionTemplate::New(getDataRateAsync, data)->GetFunction());
+    target->Set(String::New("setDataRateAsync"), FunctionTemplate::New(setDataRateAsync, data)->GetFunction());
+    target->Set(String::New("getDataRateMaxAsync"), FunctionTemplate::New(getDataRateMaxAsync, data)->GetFunction());
+    target->Set(String::New("getDataRateMinAsync"), FunctionTemplate::New(getDataRateMinAsync, data)->GetFunction());
+    target->Set(String::New("setAggregation"), FunctionTemplate::New(setAggregation, data)->GetFunction());
+    target->Set(String::New("setCalibration"), FunctionTemplate::New(setCalibration, data)->GetFunction());
+    target->Set(String::New("setChannelStats"), FunctionTemplate::New(setChannelStats, data)->GetFunction());
+    target->Set(String::New("getChannelStats"), FunctionTemplate::New(getChannelStats, data)->GetFunction());
+    target->Set(String::New("setFrameMode"), FunctionTemplate::New(setFrameMode, data)->GetFunction());
+    target->Set(String::New("setFilters"), FunctionTemplate::New(setFilters, data)->GetFunction());
+    target->Set(String::New("setTriggers"), FunctionTemplate::New(setTriggers, data)->GetFunction());
+    target->Set(String::New("pauseDevice"), FunctionTemplate::New(pauseDevice, data)->GetFunction());
+    target->Set(String::New("resumeDevice"), FunctionTemplate::New(resumeDevice, data)->GetFunction());
+    target->Set(String::New("setDataEvents"), FunctionTemplate::New(setDataEvents, data)->GetFunction());
+    target->Set(String::New("tare"), FunctionTemplate::New(tare, data)->GetFunction());
+    target->Set(String::New("getSnapshot"), FunctionTemplate::New(getSnapshot, data)->GetFunction());
+    target->Set(String::New("setHistory"), FunctionTemplate::New(setHistory, data)->GetFunction());
+    target->Set(String::New("getHistory"), FunctionTemplate::New(getHistory, data)->GetFunction());
+    target->Set(String::New("startRecording"), FunctionTemplate::New(startRecording, data)->GetFunction());
+    target->Set(String::New("stopRecording"), FunctionTemplate::New(stopRecording, data)->GetFunction());
+    target->Set(String::New("replay"), FunctionTemplate::New(replay, data)->GetFunction());
+    target->Set(String::New("stopReplay"), FunctionTemplate::New(stopReplay, data)->GetFunction());
+    target->Set(String::New("setQueueOptions"), FunctionTemplate::New(setQueueOptions, data)->GetFunction());
+    target->Set(String::New("getQueueStats"), FunctionTemplate::New(getQueueStats, data)->GetFunction());
+    target->Set(String::New("getStats"), FunctionTemplate::New(getStats, data)->GetFunction());
+    target->Set(String::New("getDroppedEvents"), FunctionTemplate::New(getDroppedEvents, data)->GetFunction());
+    target->Set(String::New("setBatchMode"), FunctionTemplate::New(setBatchMode, data)->GetFunction());
+    target->Set(String::New("enableSampleBuffer"), FunctionTemplate::New(enableSampleBuffer, data)->GetFunction());
+    target->Set(String::New("getPoolStats"), FunctionTemplate::New(getPoolStats, data)->GetFunction());
+
+    instance->dataBatch.handles.reserve(EVENT_QUEUE_CAPACITY);
+    instance->dataBatch.indices.reserve(EVENT_QUEUE_CAPACITY);
+    instance->dataBatch.values.reserve(EVENT_QUEUE_CAPACITY);
+    instance->dataBatch.timestamps.reserve(EVENT_QUEUE_CAPACITY);
+
+    uv_async_init(instance->loop, &instance->async, eventCallback);
+    instance->async.data = instance;
 }
 
 NODE_MODULE(binding, init);
@@ -0,0 +1,117 @@
+#ifndef PHIDGET_BRIDGE_CALIBRATION_H
+#define PHIDGET_BRIDGE_CALIBRATION_H
+
+#define MAX_POLYNOMIAL_TERMS 8
+#define MAX_TABLE_POINTS 32
+
+/*
+ * Converts raw bridge values (mV/V) to engineering units:
+ *
+ *   x = gain * (raw - offset)
+ *   x = c0 + c1 * x + c2 * x^2 + ...   when polynomial coefficients are set
+ *   x = table(x)                       when a table is set, interpolated
+ *                                      linearly and extrapolated from the
+ *                                      outermost segments
+ *
+ * Also averages raw samples natively to find the tare offset.
+ */
+class Calibration
+{
+public:
+    Calibration() : offset(0), gain(1), terms(0), points(0), tareTarget(0)
+    {
+    }
+
+    void configure(double newOffset, double newGain, const double *polynomial, int polynomialTerms, const double *tableX, const double *tableY, int tablePoints)
+    {
+        offset = newOffset;
+        gain = newGain;
+        terms = polynomialTerms;
+        points = tablePoints;
+
+        for (int n = 0; n < terms; n++)
+        {
+            coefficients[n] = polynomial[n];
+        }
+
+        for (int n = 0; n < points; n++)
+        {
+            x[n] = tableX[n];
+            y[n] = tableY[n];
+        }
+    }
+
+    double apply(double raw) const
+    {
+        double value = gain * (raw - offset);
+
+        if (terms > 0)
+        {
+            double result = coefficients[terms - 1];
+
+            for (int n = terms - 2; n >= 0; n--)
+            {
+                result = result * value + coefficients[n];
+            }
+
+            value = result;
+        }
+
+        if (points > 1)
+        {
+            int n = 1;
+
+            while (n < points - 1 && value > x[n])
+            {
+                n++;
+            }
+
+            value = y[n - 1] + (value - x[n - 1]) * (y[n] - y[n - 1]) / (x[n] - x[n - 1]);
+        }
+
+        return value;
+    }
+
+    void startTare(unsigned int samples)
+    {
+        tareTarget = samples;
+        tareCount = 0;
+        tareSum = 0;
+    }
+
+    bool taring() const
+    {
+        return tareTarget > 0;
+    }
+
+    // Returns true and the new offset once enough samples have been seen.
+    bool addTareSample(double raw, double &result)
+    {
+        tareSum += raw;
+
+        if (++tareCount < tareTarget)
+        {
+            return false;
+        }
+
+        offset = tareSum / tareCount;
+        tareTarget = 0;
+        result = offset;
+
+        return true;
+    }
+
+private:
+    double offset;
+    double gain;
+    double coefficients[MAX_POLYNOMIAL_TERMS];
+    int terms;
+    double x[MAX_TABLE_POINTS];
+    double y[MAX_TABLE_POINTS];
+    int points;
+    unsigned int tareTarget;
+    unsigned int tareCount;
+    double tareSum;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef PHIDGET_BRIDGE_DEVICE_H
+#define PHIDGET_BRIDGE_DEVICE_H
+
+#include <uv.h>
+#include <atomic>
+#include <phidget21.h>
+#include "aggregator.h"
+#include "baton.h"
+#include "calibration.h"
+#include "filter.h"
+#include "frame.h"
+#include "history.h"
+#include "recorder.h"
+#include "ring.h"
+#include "stats.h"
+#include "trigger.h"
+
+// Data events waiting on the JS thread per device
+#define DEVICE_QUEUE_CAPACITY 4096
+
+class Instance;
+
+class Channel
+{
+public:
+    Channel() : dataEvents(true), latestTimestamp(0), coalesced(false), deliveredTimestamp(0)
+    {
+    }
+
+    Calibration calibration;
+    FilterChain filters;
+    Aggregator aggregator;
+    History history;
+    RunningStats stats;
+    TriggerSet triggers;
+
+    // Cleared to evaluate the channel natively without a data event per sample
+    bool dataEvents;
+
+    // Most recent calibrated value, timestamp 0 until the first sample
+    double latest;
+    uint64_t latestTimestamp;
+
+    // Newest sample held back while the event queue is full and the
+    // coalesce policy is active
+    bool coalesced;
+    double coalescedValue;
+    uint64_t coalescedTimestamp;
+
+    // Timestamp of the last data event dispatched, JS thread only
+    uint64_t deliveredTimestamp;
+};
+
+/*
+ * Native state kept per bridge handle. Passed as user pointer to the
+ * library callbacks, so the data path never has to look it up, and points
+ * back to the instance that created the handle. The mutex
+ * guards the channel state, which is updated by the library thread and
+ * configured from JS. Data events of the device wait in its own ring.
+ */
+class Device
+{
+public:
+    Device(Instance *instance, CPhidgetHandle handle)
+        : instance(instance), handle(handle), events(DEVICE_QUEUE_CAPACITY), pausedDepth(0), pauses(0), recorder(NULL), removed(false), jobs(0), removing(false)
+    {
+        uv_mutex_init(&mutex);
+    }
+
+    ~Device()
+    {
+        uv_mutex_destroy(&mutex);
+    }
+
+    Instance *instance;
+    CPhidgetHandle handle;
+    uv_mutex_t mutex;
+    Channel channels[MAX_INPUTS];
+    Ring<Baton*> events;
+
+    // Non zero while a consumer has paused the device, its data events then
+    // stay queued and at most this many are kept
+    std::atomic<size_t> pausedDepth;
+
+    // Consumers that paused the device, it resumes once all of them have
+    // resumed. JS thread only.
+    int pauses;
+
+    // Frame mode, the assembler is guarded by the mutex
+    FrameAssembler frames;
+    FrameBatch frameBatch;
+
+    // Set while the samples are being recorded, guarded by the mutex
+    Recorder *recorder;
+
+    // Set when the handle is removed while the JS thread is draining, the
+    // record is then deleted once the drain is done
+    bool removed;
+
+    // Thread pool jobs queued or running for the handle, and set once a
+    // remove job is queued. The handle is only deleted when it is the last
+    // job, no other starts after it. JS thread only.
+    int jobs;
+    bool removing;
+
+    size_t queueLimit() const
+    {
+        size_t depth = pausedDepth.load(std::memory_order_relaxed);
+
+        return depth != 0 ? depth : ~(size_t)0;
+    }
+
+private:
+    Device(const Device&);
+    Device& operator=(const Device&);
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef PHIDGET_BRIDGE_FILTER_H
+#define PHIDGET_BRIDGE_FILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#define MAX_FILTER_STAGES 4
+#define MAX_AVERAGE_WINDOW 256
+#define MAX_MEDIAN_WINDOW 15
+#define MAX_BIQUAD_SECTIONS 4
+
+// M_PI is not standard and missing on MSVC
+#define FILTER_PI 3.14159265358979323846
+
+enum FilterTypes
+{
+    FILTER_NONE,
+    FILTER_AVERAGE,
+    FILTER_MEDIAN,
+    FILTER_BIQUAD
+};
+
+// One second order section, coefficients normalized so a0 is 1
+class Biquad
+{
+public:
+    double b0, b1, b2, a1, a2;
+
+    // Transposed direct form II state
+    double z1, z2;
+
+    // Butterworth low-pass section, q selects the section of a cascade
+    void lowPass(double cutoff, double sampleRate, double q)
+    {
+        double w0 = 2 * FILTER_PI * cutoff / sampleRate;
+        double alpha = sin(w0) / (2 * q);
+        double a0 = 1 + alpha;
+
+        b0 = (1 - cos(w0)) / 2 / a0;
+        b1 = (1 - cos(w0)) / a0;
+        b2 = b0;
+        a1 = -2 * cos(w0) / a0;
+        a2 = (1 - alpha) / a0;
+    }
+
+    // Sets the state as if value had been the input forever
+    void settle(double value)
+    {
+        double output = value * (b0 + b1 + b2) / (1 + a1 + a2);
+
+        z2 = b2 * value - a2 * output;
+        z1 = b1 * value - a1 * output + z2;
+    }
+
+    double apply(double value)
+    {
+        double output = b0 * value + z1;
+
+        z1 = b1 * value - a1 * output + z2;
+        z2 = b2 * value - a2 * output;
+
+        return output;
+    }
+};
+
+/*
+ * One smoothing stage: a moving average, a running median of a few
+ * samples to remove spikes, or a cascade of biquad sections. All state is
+ * kept inline, so configuring and running a filter never allocates. The
+ * first sample primes the state, a load cell sitting at a large offset
+ * does not ramp up from zero.
+ */
+class FilterStage
+{
+public:
+    FilterStage() : type(FILTER_NONE)
+    {
+    }
+
+    void average(int window)
+    {
+        type = FILTER_AVERAGE;
+        length = window;
+        primed = false;
+    }
+
+    void median(int window)
+    {
+        type = FILTER_MEDIAN;
+        length = window;
+        primed = false;
+    }
+
+    // Cascade of sections for a Butterworth low-pass of order 2 * count
+    void lowPass(double cutoff, double sampleRate, int count)
+    {
+        type = FILTER_BIQUAD;
+        length = count;
+        primed = false;
+
+        for (int n = 0; n < count; n++)
+        {
+            sections[n].lowPass(cutoff, sampleRate, 1 / (2 * cos(FILTER_PI * (2 * n + 1) / (4 * count))));
+        }
+    }
+
+    // Cascade of sections given as b0, b1, b2, a1, a2
+    void biquad(const double *coefficients, int count)
+    {
+        type = FILTER_BIQUAD;
+        length = count;
+        primed = false;
+
+        for (int n = 0; n < count; n++)
+        {
+            sections[n].b0 = coefficients[n * 5];
+            sections[n].b1 = coefficients[n * 5 + 1];
+            sections[n].b2 = coefficients[n * 5 + 2];
+            sections[n].a1 = coefficients[n * 5 + 3];
+            sections[n].a2 = coefficients[n * 5 + 4];
+        }
+    }
+
+    double apply(double value)
+    {
+        if (!primed)
+        {
+            prime(value);
+        }
+
+        switch (type)
+        {
+            case FILTER_AVERAGE:
+            {
+                sum += value - window[position];
+                window[position] = value;
+
+                // Start over from the stored samples once per round, so
+                // rounding errors can not add up
+                if (++position == length)
+                {
+                    position = 0;
+                    sum = 0;
+
+                    for (int n = 0; n < length; n++)
+                    {
+                        sum += window[n];
+                    }
+                }
+
+                return sum / length;
+            }
+            case FILTER_MEDIAN:
+            {
+                double sorted[MAX_MEDIAN_WINDOW];
+
+                window[position] = value;
+                position = (position + 1) % length;
+
+                std::copy(window, window + length, sorted);
+                std::nth_element(sorted, sorted + length / 2, sorted + length);
+
+                return sorted[length / 2];
+            }
+            case FILTER_BIQUAD:
+            {
+                for (int n = 0; n < length; n++)
+                {
+                    value = sections[n].apply(value);
+                }
+
+                return value;
+            }
+            default:
+                return value;
+        }
+    }
+
+private:
+    void prime(double value)
+    {
+        primed = true;
+        position = 0;
+
+        if (type == FILTER_BIQUAD)
+        {
+            for (int n = 0; n < length; n++)
+            {
+                sections[n].settle(value);
+            }
+
+            return;
+        }
+
+        std::fill(window, window + length, value);
+        sum = value * length;
+    }
+
+    FilterTypes type;
+    int length;
+    bool primed;
+    int position;
+    double sum;
+    double window[MAX_AVERAGE_WINDOW];
+    Biquad sections[MAX_BIQUAD_SECTIONS];
+};
+
+// The stages of one channel, applied in order to the calibrated value
+class FilterChain
+{
+public:
+    FilterChain() : count(0)
+    {
+    }
+
+    // Returns the new stage, NULL when all are taken
+    FilterStage *add()
+    {
+        return count < MAX_FILTER_STAGES ? &stages[count++] : NULL;
+    }
+
+    bool enabled() const
+    {
+        return count > 0;
+    }
+
+    double apply(double value)
+    {
+        for (int n = 0; n < count; n++)
+        {
+            value = stages[n].apply(value);
+        }
+
+        return value;
+    }
+
+private:
+    FilterStage stages[MAX_FILTER_STAGES];
+    int count;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef PHIDGET_BRIDGE_FRAME_H
+#define PHIDGET_BRIDGE_FRAME_H
+
+#include <stdint.h>
+#include <vector>
+
+// The PhidgetBridge has four inputs, leave some headroom for other models
+#define MAX_INPUTS 8
+
+// One reading of all channels of a bridge, bit n of mask set if values[n] is
+class Frame
+{
+public:
+    uint64_t timestamp;
+    unsigned int mask;
+    double values[MAX_INPUTS];
+};
+
+/*
+ * Collects the samples the library reports one channel at a time into
+ * frames. A frame is complete once every expected channel is in it. A
+ * sample for a channel the frame already holds starts the next tick, the
+ * incomplete frame is then closed with the channels it has. The timestamp
+ * of a frame is that of its first sample.
+ */
+class FrameAssembler
+{
+public:
+    FrameAssembler() : expected(0), batched(false)
+    {
+    }
+
+    void configure(unsigned int channels, bool batch)
+    {
+        expected = channels;
+        batched = batch;
+        current.mask = 0;
+        width = 0;
+
+        while (width < MAX_INPUTS && (channels >> width) != 0)
+        {
+            width++;
+        }
+    }
+
+    bool enabled() const
+    {
+        return expected != 0;
+    }
+
+    bool holds(int index) const
+    {
+        return (expected & (1 << index)) != 0;
+    }
+
+    // Returns the number of frames completed by the sample, 0 to 2. Only
+    // called for channels the frames hold.
+    int add(int index, double value, uint64_t timestamp, Frame *completed)
+    {
+        unsigned int bit = 1 << index;
+        int count = 0;
+
+        if (current.mask & bit)
+        {
+            completed[count++] = current;
+            current.mask = 0;
+        }
+
+        if (current.mask == 0)
+        {
+            current.timestamp = timestamp;
+        }
+
+        current.mask |= bit;
+        current.values[index] = value;
+
+        if (current.mask == expected)
+        {
+            completed[count++] = current;
+            current.mask = 0;
+        }
+
+        return count;
+    }
+
+    // Channels a frame is expected to hold
+    unsigned int expected;
+
+    // Values per frame passed to JS, up to the highest expected channel
+    int width;
+
+    // Frames are delivered in one frameBatch event per drain
+    bool batched;
+
+private:
+    Frame current;
+};
+
+// Frames of one device waiting for the end of the drain, JS thread only
+class FrameBatch
+{
+public:
+    std::vector<double> timestamps;
+    std::vector<unsigned char> masks;
+    std::vector<double> values;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef PHIDGET_BRIDGE_HISTOGRAM_H
+#define PHIDGET_BRIDGE_HISTOGRAM_H
+
+#include <cstring>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Linear sub-buckets per power of two, gives a worst case error of 1/16
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+/*
+ * Log-linear histogram in the spirit of HdrHistogram: values below 16 get
+ * a bucket each, above that every power of two is split into 16 equally
+ * wide buckets. Recording is a couple of bit operations and never
+ * allocates. Only meant to be used from a single thread.
+ */
+class Histogram
+{
+public:
+    Histogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(buckets, 0, sizeof(buckets));
+        total = 0;
+        sum = 0;
+        minimum = 0;
+        maximum = 0;
+    }
+
+    void record(uint64_t value)
+    {
+        buckets[bucketOf(value)]++;
+
+        if (total == 0 || value < minimum)
+        {
+            minimum = value;
+        }
+
+        if (value > maximum)
+        {
+            maximum = value;
+        }
+
+        total++;
+        sum += value;
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    uint64_t min() const
+    {
+        return minimum;
+    }
+
+    uint64_t max() const
+    {
+        return maximum;
+    }
+
+    double mean() const
+    {
+        return total > 0 ? (double)sum / total : 0;
+    }
+
+    // Upper bound of the bucket holding the given fraction of all values
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t target = (uint64_t)(fraction * total + 0.5);
+        uint64_t seen = 0;
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        if (target < 1)
+        {
+            target = 1;
+        }
+
+        for (int n = 0; n < HISTOGRAM_BUCKETS; n++)
+        {
+            seen += buckets[n];
+
+            if (seen >= target)
+            {
+                uint64_t upper = upperBound(n);
+                return upper < maximum ? upper : maximum;
+            }
+        }
+
+        return maximum;
+    }
+
+private:
+    static int bucketOf(uint64_t value)
+    {
+        if (value < HISTOGRAM_SUB_BUCKETS)
+        {
+            return (int)value;
+        }
+
+#ifdef _MSC_VER
+        unsigned long exponent;
+        _BitScanReverse64(&exponent, value);
+#else
+        int exponent = 63 - __builtin_clzll(value);
+#endif
+        int shift = (int)exponent - HISTOGRAM_SUB_BITS;
+
+        return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < HISTOGRAM_SUB_BUCKETS)
+        {
+            return bucket;
+        }
+
+        int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+        uint64_t mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t minimum;
+    uint64_t maximum;
+};
+
+#endif
@@ -0,0 +1,600 @@
+#ifndef PHIDGET_BRIDGE_HISTORY_H
+#define PHIDGET_BRIDGE_HISTORY_H
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// 4 KB of compressed samples per block
+#define HISTORY_BLOCK_WORDS 512
+
+// Spare blocks kept ready for the library thread, enough for a few
+// thousand samples between two refills
+#define HISTORY_SPARE_BLOCKS 4
+
+// Worst case size of one sample: 4 + 64 bits timestamp, 2 + 5 + 6 + 64 bits value
+#define HISTORY_SAMPLE_MAX_BITS 145
+
+static inline uint64_t historyMask(int bits)
+{
+    return bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+}
+
+static inline int leadingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(value);
+#endif
+}
+
+static inline int trailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+/*
+ * A run of samples compressed as in Facebook's Gorilla paper: timestamps
+ * (microseconds) as delta of delta in variable width buckets, values as
+ * the XOR with the previous value, storing only the meaningful bits. At a
+ * steady data rate most timestamps take a single bit, and slowly moving
+ * values a fraction of their 64 bits. Each block starts over with a full
+ * sample so it can be decoded on its own.
+ */
+class HistoryBlock
+{
+public:
+    HistoryBlock() : next(NULL)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(words, 0, sizeof(words));
+        bits = 0;
+        count = 0;
+    }
+
+    bool full() const
+    {
+        return bits + HISTORY_SAMPLE_MAX_BITS > HISTORY_BLOCK_WORDS * 64;
+    }
+
+    void append(uint64_t timestamp, double value)
+    {
+        uint64_t raw;
+
+        memcpy(&raw, &value, sizeof(raw));
+
+        if (count == 0)
+        {
+            write(timestamp, 64);
+            write(raw, 64);
+            first = last = timestamp;
+            delta = 0;
+            leading = -1;
+            trailing = 0;
+        }
+        else
+        {
+            appendTimestamp(timestamp);
+            appendValue(raw ^ previous);
+        }
+
+        if (timestamp < first)
+        {
+            first = timestamp;
+        }
+
+        if (timestamp > last)
+        {
+            last = timestamp;
+        }
+
+        previousTimestamp = timestamp;
+        previous = raw;
+        count++;
+    }
+
+    uint64_t words[HISTORY_BLOCK_WORDS];
+    size_t bits;
+    uint32_t count;
+
+    // Next newer block of the history, or next spare
+    HistoryBlock *next;
+
+    // Oldest and newest timestamp in the block
+    uint64_t first;
+    uint64_t last;
+
+private:
+    void write(uint64_t value, int length)
+    {
+        while (length > 0)
+        {
+            int offset = (int)(bits & 63);
+            int space = 64 - offset;
+            int take = length < space ? length : space;
+            uint64_t chunk = (value >> (length - take)) & historyMask(take);
+
+            words[bits >> 6] |= chunk << (space - take);
+            bits += take;
+            length -= take;
+        }
+    }
+
+    void appendTimestamp(uint64_t timestamp)
+    {
+        int64_t next = (int64_t)(timestamp - previousTimestamp);
+        int64_t dod = next - delta;
+
+        if (dod == 0)
+        {
+            write(0, 1);
+        }
+        else if (dod >= -63 && dod <= 64)
+        {
+            write(2, 2);
+            write(dod + 63, 7);
+        }
+        else if (dod >= -255 && dod <= 256)
+        {
+            write(6, 3);
+            write(dod + 255, 9);
+        }
+        else if (dod >= -2047 && dod <= 2048)
+        {
+            write(14, 4);
+            write(dod + 2047, 12);
+        }
+        else
+        {
+            write(15, 4);
+            write((uint64_t)dod, 64);
+        }
+
+        delta = next;
+    }
+
+    void appendValue(uint64_t xored)
+    {
+        if (xored == 0)
+        {
+            write(0, 1);
+            return;
+        }
+
+        int zerosBefore = leadingZeros(xored);
+        int zerosAfter = trailingZeros(xored);
+
+        if (zerosBefore > 31)
+        {
+            zerosBefore = 31;
+        }
+
+        // Reuse the previous window when the meaningful bits fit in it
+        if (leading >= 0 && zerosBefore >= leading && zerosAfter >= trailing)
+        {
+            write(2, 2);
+            write(xored >> trailing, 64 - leading - trailing);
+            return;
+        }
+
+        int length = 64 - zerosBefore - zerosAfter;
+
+        write(3, 2);
+        write(zerosBefore, 5);
+        write(length - 1, 6);
+        write(xored >> zerosAfter, length);
+
+        leading = zerosBefore;
+        trailing = zerosAfter;
+    }
+
+    // Encoder state
+    uint64_t previousTimestamp;
+    int64_t delta;
+    uint64_t previous;
+    int leading;
+    int trailing;
+};
+
+// Decodes a block front to back
+class HistoryReader
+{
+public:
+    explicit HistoryReader(const HistoryBlock &block) : block(block), bits(0), index(0)
+    {
+    }
+
+    bool next(uint64_t &timestamp, double &value)
+    {
+        if (index == block.count)
+        {
+            return false;
+        }
+
+        if (index == 0)
+        {
+            current = read(64);
+            previous = read(64);
+            delta = 0;
+            leading = 0;
+            trailing = 0;
+        }
+        else
+        {
+            readTimestamp();
+            readValue();
+        }
+
+        index++;
+        timestamp = current;
+        memcpy(&value, &previous, sizeof(value));
+
+        return true;
+    }
+
+private:
+    HistoryReader& operator=(const HistoryReader&);
+
+    uint64_t read(int length)
+    {
+        uint64_t value = 0;
+
+        while (length > 0)
+        {
+            int offset = (int)(bits & 63);
+            int space = 64 - offset;
+            int take = length < space ? length : space;
+            uint64_t chunk = (block.words[bits >> 6] >> (space - take)) & historyMask(take);
+
+            value = (take == 64 ? 0 : value << take) | chunk;
+            bits += take;
+            length -= take;
+        }
+
+        return value;
+    }
+
+    void readTimestamp()
+    {
+        int64_t dod;
+
+        if (read(1) == 0)
+        {
+            dod = 0;
+        }
+        else if (read(1) == 0)
+        {
+            dod = (int64_t)read(7) - 63;
+        }
+        else if (read(1) == 0)
+        {
+            dod = (int64_t)read(9) - 255;
+        }
+        else if (read(1) == 0)
+        {
+            dod = (int64_t)read(12) - 2047;
+        }
+        else
+        {
+            dod = (int64_t)read(64);
+        }
+
+        delta += dod;
+        current += delta;
+    }
+
+    void readValue()
+    {
+        if (read(1) == 0)
+        {
+            return;
+        }
+
+        if (read(1) == 1)
+        {
+            leading = (int)read(5);
+            int length = (int)read(6) + 1;
+            trailing = 64 - leading - length;
+        }
+
+        previous ^= read(64 - leading - trailing) << trailing;
+    }
+
+    const HistoryBlock &block;
+    size_t bits;
+    uint32_t index;
+    uint64_t current;
+    int64_t delta;
+    uint64_t previous;
+    int leading;
+    int trailing;
+};
+
+// The blocks of a history at the time of a query, see History::pin
+class HistorySnapshot
+{
+public:
+    HistorySnapshot() : oldest(NULL), newest(NULL)
+    {
+    }
+
+    // Appends the samples from fromNs up to and including toNs, in ms
+    void query(uint64_t fromNs, uint64_t toNs, std::vector<double> &timestamps, std::vector<double> &values) const
+    {
+        uint64_t from = fromNs / 1000, to = toNs / 1000;
+
+        for (const HistoryBlock *block = oldest; block != NULL; block = block->next)
+        {
+            const HistoryBlock &current = block == newest ? last : *block;
+            uint64_t timestamp;
+            double value;
+
+            if (current.count != 0 && current.last >= from && current.first <= to)
+            {
+                HistoryReader reader(current);
+
+                while (reader.next(timestamp, value))
+                {
+                    if (timestamp >= from && timestamp <= to)
+                    {
+                        timestamps.push_back(timestamp / 1e3);
+                        values.push_back(value);
+                    }
+                }
+            }
+
+            // Blocks added after the snapshot are not part of it
+            if (block == newest)
+            {
+                break;
+            }
+        }
+    }
+
+    const HistoryBlock *oldest;
+    const HistoryBlock *newest;
+
+    // Copy of the newest block
+    HistoryBlock last;
+};
+
+/*
+ * Compressed samples of one channel for the last retention period. Whole
+ * blocks are dropped once all their samples are too old, so slightly more
+ * than the retention is kept. Not thread safe, the owning channel's mutex
+ * guards it.
+ * add() runs on the library thread and never allocates: new blocks come
+ * from a list of spares that the JS thread keeps filled, and expired blocks
+ * go back to it. When the spares run out anyway the oldest block is reused
+ * and its samples are lost before their time.
+ * A query pins the blocks and decodes them after the lock is released, so
+ * a long query does not hold up the library thread. While pinned no block
+ * in use expires or is reused, samples that find no spare are dropped.
+ */
+class History
+{
+public:
+    History() : retention(0), oldest(NULL), newest(NULL), count(0), spares(NULL), spareCount(0), overwritten(0), dropped(0), pinned(false)
+    {
+    }
+
+    ~History()
+    {
+        configure(0);
+    }
+
+    // Retention in nanoseconds, 0 drops everything and stops recording
+    void configure(uint64_t retentionNs)
+    {
+        retention = retentionNs;
+
+        if (retention == 0)
+        {
+            release(oldest);
+            release(spares);
+            oldest = newest = spares = NULL;
+            count = spareCount = 0;
+        }
+    }
+
+    bool enabled() const
+    {
+        return retention != 0;
+    }
+
+    // Returns true when it took a spare block and more are wanted
+    bool add(uint64_t timestamp, double value)
+    {
+        uint64_t micros = timestamp / 1000;
+        bool wanted = false;
+
+        if (newest == NULL || newest->full())
+        {
+            if (!pinned)
+            {
+                expire(micros);
+            }
+
+            HistoryBlock *block = spares;
+
+            if (block != NULL)
+            {
+                spares = block->next;
+                spareCount--;
+                wanted = spareCount < HISTORY_SPARE_BLOCKS;
+            }
+            else if (oldest != NULL && !pinned)
+            {
+                block = oldest;
+                oldest = block->next;
+                count--;
+                overwritten++;
+                wanted = true;
+            }
+            else
+            {
+                dropped++;
+                return true;
+            }
+
+            block->reset();
+            block->next = NULL;
+
+            if (newest != NULL && oldest != NULL)
+            {
+                newest->next = block;
+            }
+            else
+            {
+                oldest = block;
+            }
+
+            newest = block;
+            count++;
+        }
+
+        newest->append(micros, value);
+
+        return wanted;
+    }
+
+    // Spare blocks to allocate before calling refill
+    int missing() const
+    {
+        return enabled() && spareCount < HISTORY_SPARE_BLOCKS ? HISTORY_SPARE_BLOCKS - (int)spareCount : 0;
+    }
+
+    // Takes over a chain of blocks linked through next
+    void refill(HistoryBlock *blocks)
+    {
+        while (blocks != NULL)
+        {
+            HistoryBlock *block = blocks;
+
+            blocks = block->next;
+            block->next = spares;
+            spares = block;
+            spareCount++;
+        }
+    }
+
+    // Detaches the spares beyond what is kept, to be deleted by the caller
+    // outside the lock
+    HistoryBlock *trim()
+    {
+        HistoryBlock *excess = NULL;
+
+        while (spareCount > HISTORY_SPARE_BLOCKS)
+        {
+            HistoryBlock *block = spares;
+
+            spares = block->next;
+            block->next = excess;
+            excess = block;
+            spareCount--;
+        }
+
+        return excess;
+    }
+
+    // Deletes a chain of blocks linked through next
+    static void release(HistoryBlock *blocks)
+    {
+        while (blocks != NULL)
+        {
+            HistoryBlock *block = blocks;
+
+            blocks = block->next;
+            delete block;
+        }
+    }
+
+    // Takes the blocks in use for decoding without the lock, the newest one
+    // is still being written and is copied. Called with the lock held, the
+    // blocks stay pinned until unpin().
+    void pin(HistorySnapshot &snapshot)
+    {
+        pinned = true;
+        snapshot.oldest = oldest;
+        snapshot.newest = newest;
+
+        if (newest != NULL)
+        {
+            snapshot.last = *newest;
+        }
+    }
+
+    void unpin()
+    {
+        pinned = false;
+    }
+
+    size_t bytes() const
+    {
+        return (count + spareCount) * sizeof(HistoryBlock);
+    }
+
+    // Blocks reused before their samples expired because no spare was left
+    unsigned long overwrittenCount() const
+    {
+        return overwritten;
+    }
+
+    // Samples lost while pinned because no spare was left
+    unsigned long droppedCount() const
+    {
+        return dropped;
+    }
+
+private:
+    History(const History&);
+    History& operator=(const History&);
+
+    void expire(uint64_t now)
+    {
+        uint64_t limit = retention / 1000;
+
+        while (oldest != newest && oldest->last + limit < now)
+        {
+            HistoryBlock *block = oldest;
+
+            oldest = block->next;
+            count--;
+            block->next = spares;
+            spares = block;
+            spareCount++;
+        }
+    }
+
+    uint64_t retention;
+
+    // Blocks in use, oldest first
+    HistoryBlock *oldest;
+    HistoryBlock *newest;
+    size_t count;
+
+    HistoryBlock *spares;
+    size_t spareCount;
+    unsigned long overwritten;
+    unsigned long dropped;
+    bool pinned;
+};
+
+#endif
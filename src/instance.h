@@ -0,0 +1,149 @@
+#ifndef PHIDGET_BRIDGE_INSTANCE_H
+#define PHIDGET_BRIDGE_INSTANCE_H
+
+#include <uv.h>
+#include <v8.h>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "baton.h"
+#include "device.h"
+#include "histogram.h"
+#include "queue.h"
+#include "samplebuffer.h"
+
+// Upper bounds for events waiting on the JS thread, producers drop events
+// rather than block when they are reached.
+#define EVENT_QUEUE_CAPACITY 16384
+#define CONTROL_QUEUE_CAPACITY 1024
+
+// Distinct error texts kept as JS strings, the library only has a handful
+#define ERROR_STRING_CACHE 64
+
+// Samples collected during one drain when batch mode is enabled, kept
+// around between drains so steady state does not allocate.
+class DataBatch
+{
+public:
+    std::vector<double> handles;
+    std::vector<unsigned char> indices;
+    std::vector<double> values;
+    std::vector<double> timestamps;
+};
+
+// Counters for the JS side of the event path, only touched by the JS thread
+class PipelineStats
+{
+public:
+    PipelineStats()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(events, 0, sizeof(events));
+        drains = 0;
+        maxQueueDepth = 0;
+        eventsPerDrain.reset();
+        drainDuration.reset();
+
+        for (int n = 0; n < EVENT_TYPES; n++)
+        {
+            latency[n].reset();
+        }
+    }
+
+    uint64_t events[EVENT_TYPES];
+    Histogram latency[EVENT_TYPES];
+    uint64_t drains;
+    Histogram eventsPerDrain;
+    Histogram drainDuration;
+    size_t maxQueueDepth;
+};
+
+class ReplayJob;
+class WorkBaton;
+
+// Identifies a read: handle and index, operation
+typedef std::pair<std::pair<long, int>, int> ReadKey;
+
+// Strings passed to JS with every event, created once instead of per event
+class Symbols
+{
+public:
+    v8::Persistent<v8::String> events[EVENT_TYPES];
+    v8::Persistent<v8::String> dataBatch;
+    v8::Persistent<v8::String> frameBatch;
+    v8::Persistent<v8::String> drain;
+    v8::Persistent<v8::String> min;
+    v8::Persistent<v8::String> max;
+    v8::Persistent<v8::String> mean;
+    v8::Persistent<v8::String> last;
+    v8::Persistent<v8::String> count;
+    v8::Persistent<v8::String> start;
+    v8::Persistent<v8::String> end;
+    v8::Persistent<v8::String> trigger;
+    v8::Persistent<v8::String> edge;
+    v8::Persistent<v8::String> rising;
+    v8::Persistent<v8::String> falling;
+    v8::Persistent<v8::String> value;
+    v8::Persistent<v8::String> timestamp;
+};
+
+/*
+ * Everything the addon keeps: the emitter events are delivered to, the
+ * async handle waking up the loop, the event queues and the devices
+ * created through it. There is exactly one, created by init() on the
+ * default loop, the addon is not context aware. Library callbacks reach
+ * it through the device they fire for. Apart from the queues and the
+ * atomics, members are only touched by the loop's thread.
+ */
+class Instance
+{
+public:
+    explicit Instance(uv_loop_t *loop)
+        : loop(loop), eventQueue(EVENT_QUEUE_CAPACITY, CONTROL_QUEUE_CAPACITY, DEVICE_QUEUE_CAPACITY), coalescePending(false), historyPending(false),
+          batchMode(false), sampleBuffer(NULL), sampleBufferEvents(true), drainStart(0), draining(false), manager(NULL)
+    {
+    }
+
+    uv_loop_t *loop;
+    uv_async_t async;
+    v8::Persistent<v8::Object> emitter;
+    v8::Persistent<v8::Function> emit;
+    Symbols symbols;
+    std::map<std::string, v8::Persistent<v8::String> > errorStrings;
+    EventQueue eventQueue;
+    std::atomic<bool> coalescePending;
+
+    // Set by the library threads when a channel history runs short of
+    // spare blocks
+    std::atomic<bool> historyPending;
+    PipelineStats pipelineStats;
+    bool batchMode;
+    DataBatch dataBatch;
+    std::atomic<SampleBuffer*> sampleBuffer;
+    std::atomic<bool> sampleBufferEvents;
+    v8::Persistent<v8::Object> sampleBufferHeader;
+    v8::Persistent<v8::Object> sampleBufferRecords;
+    std::map<long, Device*> devices;
+    std::vector<Device*> deviceOrder;
+    std::vector<size_t> drainPending;
+    size_t drainStart;
+    bool draining;
+    std::map<std::pair<long, int>, v8::Persistent<v8::Function> > tareCallbacks;
+    std::map<long, ReplayJob*> replays;
+    std::map<ReadKey, WorkBaton*> pendingReads;
+
+    // Reports bridges plugged in and out while open
+    CPhidgetManagerHandle manager;
+
+private:
+    Instance(const Instance&);
+    Instance& operator=(const Instance&);
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef PHIDGET_BRIDGE_POOL_H
+#define PHIDGET_BRIDGE_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include "ring.h"
+
+/*
+ * Fixed set of preallocated records handed out to producer threads and
+ * returned once consumed. Free records are kept in a lock-free ring, so
+ * neither side touches the heap or blocks after construction. acquire()
+ * returns NULL when every record is in use.
+ */
+template <typename T>
+class Pool
+{
+public:
+    explicit Pool(size_t capacity)
+        : records(new T[capacity]), freeRecords(capacity), size(capacity), used(0), highWater(0), exhausted(0)
+    {
+        for (size_t i = 0; i < capacity; i++)
+        {
+            freeRecords.push(&records[i]);
+        }
+    }
+
+    ~Pool()
+    {
+        delete[] records;
+    }
+
+    T *acquire()
+    {
+        T *record;
+        int attempts = 0;
+
+        // The ring can look empty for a moment while another thread is
+        // half way through returning a record, possibly preempted, so only
+        // give up when the pool really is used up or that takes too long.
+        while (!freeRecords.pop(record))
+        {
+            if (used.load(std::memory_order_relaxed) >= size || ++attempts == 256)
+            {
+                exhausted.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+
+            if (attempts % 16 == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        size_t count = used.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t peak = highWater.load(std::memory_order_relaxed);
+
+        while (count > peak && !highWater.compare_exchange_weak(peak, count, std::memory_order_relaxed))
+        {
+        }
+
+        return record;
+    }
+
+    void release(T *record)
+    {
+        freeRecords.push(record);
+        used.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Whether record was handed out by this pool
+    bool owns(const T *record) const
+    {
+        return record >= records && record < records + size;
+    }
+
+    size_t capacity() const
+    {
+        return size;
+    }
+
+    size_t inUse() const
+    {
+        return used.load(std::memory_order_relaxed);
+    }
+
+    size_t peakInUse() const
+    {
+        return highWater.load(std::memory_order_relaxed);
+    }
+
+    unsigned long exhaustedCount() const
+    {
+        return exhausted.load(std::memory_order_relaxed);
+    }
+
+private:
+    Pool(const Pool&);
+    Pool& operator=(const Pool&);
+
+    T *records;
+    Ring<T*> freeRecords;
+    size_t size;
+    std::atomic<size_t> used;
+    std::atomic<size_t> highWater;
+    std::atomic<unsigned long> exhausted;
+};
+
+#endif
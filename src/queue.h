@@ -0,0 +1,184 @@
+#ifndef PHIDGET_BRIDGE_QUEUE_H
+#define PHIDGET_BRIDGE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include "baton.h"
+#include "pool.h"
+#include "ring.h"
+
+enum QueuePolicies
+{
+    DROP_NEWEST,
+    DROP_OLDEST,
+    COALESCE
+};
+
+/*
+ * Events on their way from the library threads to the JS thread. Control
+ * events share one ring that is drained before any data, while data
+ * events go to a ring owned by the device they came from, so one busy
+ * device can neither push out an attach, detach or error event nor starve
+ * the other devices. Each data ring is limited to maxDepth events, when
+ * that is reached the policy decides whether the new or the oldest event
+ * is dropped, while the shared baton pool bounds the data events of all
+ * devices together. Control events take their batons from a pool of their
+ * own, so data filling up the rings of many devices can not starve them.
+ * Coalescing is done by the caller (it needs the channel
+ * state), the queue only falls back to dropping newest for events that
+ * cannot be coalesced.
+ */
+class EventQueue
+{
+public:
+    EventQueue(size_t totalCapacity, size_t controlCapacity, size_t dataCapacity)
+        : pool(totalCapacity + 64), controlPool(controlCapacity + 64), control(controlCapacity), capacity(dataCapacity), depth(dataCapacity), mode(DROP_NEWEST),
+          droppedNewest(0), droppedOldest(0), coalesced(0), droppedControl(0)
+    {
+    }
+
+    Baton *acquire(long handle, Events event)
+    {
+        Baton *baton = isControlEvent(event) ? controlPool.acquire() : pool.acquire();
+
+        if (baton != NULL)
+        {
+            baton->handle = handle;
+            baton->event = event;
+            baton->index = -1;
+        }
+
+        return baton;
+    }
+
+    void release(Baton *baton)
+    {
+        if (controlPool.owns(baton))
+        {
+            controlPool.release(baton);
+        }
+        else
+        {
+            pool.release(baton);
+        }
+    }
+
+    // A limit below maxDepth holds the data ring to that many events
+    void push(Baton *baton, Ring<Baton*> &data, size_t limit = ~(size_t)0)
+    {
+        if (isControlEvent(baton->event))
+        {
+            pushControl(baton);
+            return;
+        }
+
+        if (full(data, limit) || !data.push(baton))
+        {
+            Baton *oldest;
+
+            if (policy() == DROP_OLDEST && data.pop(oldest))
+            {
+                droppedOldest.fetch_add(1, std::memory_order_relaxed);
+                pool.release(oldest);
+
+                if (data.push(baton))
+                {
+                    return;
+                }
+            }
+
+            droppedNewest.fetch_add(1, std::memory_order_relaxed);
+            pool.release(baton);
+        }
+    }
+
+    // For control events that do not belong to a device
+    void pushControl(Baton *baton)
+    {
+        if (!control.push(baton))
+        {
+            droppedControl.fetch_add(1, std::memory_order_relaxed);
+            release(baton);
+        }
+    }
+
+    bool full(const Ring<Baton*> &data, size_t limit = ~(size_t)0) const
+    {
+        size_t maxDepth = depth.load(std::memory_order_relaxed);
+
+        return data.size() >= (limit < maxDepth ? limit : maxDepth);
+    }
+
+    // Records a sample that replaced an older, not yet delivered one
+    void countCoalesced()
+    {
+        coalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void configure(size_t maxDepth, QueuePolicies newPolicy)
+    {
+        depth.store(maxDepth < capacity ? maxDepth : capacity, std::memory_order_relaxed);
+        mode.store(newPolicy, std::memory_order_relaxed);
+    }
+
+    QueuePolicies policy() const
+    {
+        return (QueuePolicies)mode.load(std::memory_order_relaxed);
+    }
+
+    size_t maxDepth() const
+    {
+        return depth.load(std::memory_order_relaxed);
+    }
+
+    // Size of each device's data ring
+    size_t dataCapacity() const
+    {
+        return capacity;
+    }
+
+    unsigned long dropped() const
+    {
+        return droppedNewest.load(std::memory_order_relaxed) + droppedOldest.load(std::memory_order_relaxed) + coalesced.load(std::memory_order_relaxed) +
+               droppedControl.load(std::memory_order_relaxed) + pool.exhaustedCount() + controlPool.exhaustedCount();
+    }
+
+    unsigned long droppedNewestCount() const
+    {
+        return droppedNewest.load(std::memory_order_relaxed);
+    }
+
+    unsigned long droppedOldestCount() const
+    {
+        return droppedOldest.load(std::memory_order_relaxed);
+    }
+
+    unsigned long coalescedCount() const
+    {
+        return coalesced.load(std::memory_order_relaxed);
+    }
+
+    unsigned long droppedControlCount() const
+    {
+        return droppedControl.load(std::memory_order_relaxed);
+    }
+
+    // Consumed directly by the JS thread
+    Pool<Baton> pool;
+    Pool<Baton> controlPool;
+    Ring<Baton*> control;
+
+private:
+    EventQueue(const EventQueue&);
+    EventQueue& operator=(const EventQueue&);
+
+    size_t capacity;
+    std::atomic<size_t> depth;
+    std::atomic<int> mode;
+    std::atomic<unsigned long> droppedNewest;
+    std::atomic<unsigned long> droppedOldest;
+    std::atomic<unsigned long> coalesced;
+    std::atomic<unsigned long> droppedControl;
+};
+
+#endif
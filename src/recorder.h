@@ -0,0 +1,219 @@
+#ifndef PHIDGET_BRIDGE_RECORDER_H
+#define PHIDGET_BRIDGE_RECORDER_H
+
+#include <uv.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include "ring.h"
+
+// File header: magic followed by the uint64 hrtime the recording started at
+#define RECORDING_MAGIC "PHBRREC1"
+#define RECORDING_MAGIC_LENGTH 8
+#define RECORDING_HEADER_SIZE (RECORDING_MAGIC_LENGTH + 8)
+
+// Bytes per sample: uint64 nanoseconds since start, uint8 index, double value
+#define RECORDING_SAMPLE_SIZE 17
+
+// Samples waiting for the writer thread, the writer is woken early once
+// a quarter of this is queued
+#define RECORDER_QUEUE_CAPACITY 65536
+#define RECORDER_BUFFER_SIZE (256 * 1024)
+#define RECORDER_FLUSH_INTERVAL 50000000ULL
+
+class RecordedSample
+{
+public:
+    uint64_t timestamp;
+    double value;
+    int index;
+};
+
+static inline void encodeSample(unsigned char *out, uint64_t timestamp, int index, double value)
+{
+    memcpy(out, &timestamp, 8);
+    out[8] = (unsigned char)index;
+    memcpy(out + 9, &value, 8);
+}
+
+static inline void decodeSample(const unsigned char *in, uint64_t &timestamp, int &index, double &value)
+{
+    memcpy(&timestamp, in, 8);
+    index = in[8];
+    memcpy(&value, in + 9, 8);
+}
+
+/*
+ * Appends the samples of one handle to a binary log. The library thread
+ * only pushes into a lock-free ring, a writer thread of our own empties it
+ * through a large stdio buffer, so file I/O never runs on the callback
+ * path. Samples that do not fit in the ring are counted and dropped. All
+ * values are stored in host byte order.
+ */
+class Recorder
+{
+public:
+    Recorder() : samples(RECORDER_QUEUE_CAPACITY), file(NULL), running(false), failed(false), written(0), dropped(0)
+    {
+        uv_mutex_init(&mutex);
+        uv_cond_init(&wake);
+    }
+
+    ~Recorder()
+    {
+        stop();
+        uv_cond_destroy(&wake);
+        uv_mutex_destroy(&mutex);
+    }
+
+    bool start(const char *path)
+    {
+        unsigned char header[RECORDING_HEADER_SIZE];
+
+        file = fopen(path, "wb");
+
+        if (file == NULL)
+        {
+            return false;
+        }
+
+        setvbuf(file, NULL, _IOFBF, RECORDER_BUFFER_SIZE);
+
+        begin = uv_hrtime();
+        memcpy(header, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH);
+        memcpy(header + RECORDING_MAGIC_LENGTH, &begin, 8);
+
+        if (fwrite(header, sizeof(header), 1, file) != 1)
+        {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+
+        running = true;
+        uv_thread_create(&thread, run, this);
+
+        return true;
+    }
+
+    // Called from the library thread
+    void add(int index, double value, uint64_t timestamp)
+    {
+        RecordedSample sample;
+
+        sample.timestamp = timestamp;
+        sample.value = value;
+        sample.index = index;
+
+        if (!samples.push(sample))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (samples.size() == RECORDER_QUEUE_CAPACITY / 4)
+        {
+            uv_cond_signal(&wake);
+        }
+    }
+
+    // Writes out what is queued and closes the file
+    void stop()
+    {
+        if (file == NULL)
+        {
+            return;
+        }
+
+        uv_mutex_lock(&mutex);
+        running = false;
+        uv_cond_signal(&wake);
+        uv_mutex_unlock(&mutex);
+
+        uv_thread_join(&thread);
+
+        if (fclose(file) != 0)
+        {
+            failed = true;
+        }
+
+        file = NULL;
+    }
+
+    unsigned long samplesWritten() const
+    {
+        return written;
+    }
+
+    unsigned long samplesDropped() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    bool writeFailed() const
+    {
+        return failed;
+    }
+
+private:
+    Recorder(const Recorder&);
+    Recorder& operator=(const Recorder&);
+
+    static void run(void *arg)
+    {
+        Recorder *recorder = (Recorder*)arg;
+        bool running = true;
+
+        while (running)
+        {
+            uv_mutex_lock(&recorder->mutex);
+
+            if (recorder->running)
+            {
+                uv_cond_timedwait(&recorder->wake, &recorder->mutex, RECORDER_FLUSH_INTERVAL);
+            }
+
+            running = recorder->running;
+            uv_mutex_unlock(&recorder->mutex);
+
+            recorder->flush();
+        }
+    }
+
+    void flush()
+    {
+        unsigned char record[RECORDING_SAMPLE_SIZE];
+        RecordedSample sample;
+
+        while (samples.pop(sample))
+        {
+            // Samples stamped just before start() count as the first one
+            encodeSample(record, sample.timestamp > begin ? sample.timestamp - begin : 0, sample.index, sample.value);
+
+            if (fwrite(record, sizeof(record), 1, file) != 1)
+            {
+                failed = true;
+                continue;
+            }
+
+            written++;
+        }
+    }
+
+    Ring<RecordedSample> samples;
+    FILE *file;
+    uint64_t begin;
+    uv_thread_t thread;
+    uv_mutex_t mutex;
+    uv_cond_t wake;
+    bool running;
+
+    // Only touched by the writer thread until stop() has joined it
+    bool failed;
+    unsigned long written;
+
+    std::atomic<unsigned long> dropped;
+};
+
+#endif
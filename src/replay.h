@@ -0,0 +1,176 @@
+#ifndef PHIDGET_BRIDGE_REPLAY_H
+#define PHIDGET_BRIDGE_REPLAY_H
+
+#include <uv.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include "recorder.h"
+
+typedef void (*ReplaySink)(void *context, int index, double value);
+
+/*
+ * Plays a log written by Recorder back on a thread of its own, handing
+ * every sample to the sink at the pace it was recorded divided by speed,
+ * or as fast as possible when speed is 0. The sink runs on the replay
+ * thread just like a library callback would.
+ */
+class Replay
+{
+public:
+    Replay(ReplaySink sink, void *context) : sink(sink), context(context), file(NULL), stopping(false), started(false), failed(false), played(0)
+    {
+        uv_mutex_init(&mutex);
+        uv_cond_init(&wake);
+    }
+
+    ~Replay()
+    {
+        stop();
+        uv_cond_destroy(&wake);
+        uv_mutex_destroy(&mutex);
+    }
+
+    // Opens and checks the log, false when it is missing or not a recording
+    bool open(const char *path)
+    {
+        unsigned char header[RECORDING_HEADER_SIZE];
+
+        file = fopen(path, "rb");
+
+        if (file == NULL)
+        {
+            return false;
+        }
+
+        setvbuf(file, NULL, _IOFBF, RECORDER_BUFFER_SIZE);
+
+        if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH) != 0)
+        {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+
+        return true;
+    }
+
+    // done is signalled from the replay thread once the log is played out
+    void start(double replaySpeed, uv_async_t *replayDone)
+    {
+        speed = replaySpeed;
+        done = replayDone;
+        started = true;
+        uv_thread_create(&thread, run, this);
+    }
+
+    // Stops early and waits for the thread, safe to call more than once
+    void stop()
+    {
+        if (started)
+        {
+            uv_mutex_lock(&mutex);
+            stopping = true;
+            uv_cond_signal(&wake);
+            uv_mutex_unlock(&mutex);
+
+            uv_thread_join(&thread);
+            started = false;
+        }
+
+        if (file != NULL)
+        {
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    unsigned long samplesPlayed() const
+    {
+        return played.load(std::memory_order_relaxed);
+    }
+
+    // True when the log ended in the middle of a sample
+    bool truncated() const
+    {
+        return failed;
+    }
+
+private:
+    Replay(const Replay&);
+    Replay& operator=(const Replay&);
+
+    static void run(void *arg)
+    {
+        Replay *replay = (Replay*)arg;
+
+        replay->play();
+        uv_async_send(replay->done);
+    }
+
+    void play()
+    {
+        unsigned char record[RECORDING_SAMPLE_SIZE];
+        uint64_t begin = uv_hrtime();
+        uint64_t timestamp;
+        double value;
+        size_t length;
+        int index;
+
+        while ((length = fread(record, 1, sizeof(record), file)) == sizeof(record))
+        {
+            decodeSample(record, timestamp, index, value);
+
+            if (!wait(speed > 0 ? begin + (uint64_t)(timestamp / speed) : 0))
+            {
+                return;
+            }
+
+            sink(context, index, value);
+            played.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        failed = length != 0;
+    }
+
+    // Sleeps until the hrtime deadline, false when stopped meanwhile
+    bool wait(uint64_t deadline)
+    {
+        bool running;
+
+        uv_mutex_lock(&mutex);
+
+        for (;;)
+        {
+            uint64_t now = uv_hrtime();
+
+            if (stopping || now >= deadline)
+            {
+                break;
+            }
+
+            uv_cond_timedwait(&wake, &mutex, deadline - now);
+        }
+
+        running = !stopping;
+        uv_mutex_unlock(&mutex);
+
+        return running;
+    }
+
+    ReplaySink sink;
+    void *context;
+    FILE *file;
+    double speed;
+    uv_async_t *done;
+    uv_thread_t thread;
+    uv_mutex_t mutex;
+    uv_cond_t wake;
+    bool stopping;
+    bool started;
+    bool failed;
+    std::atomic<unsigned long> played;
+};
+
+#endif
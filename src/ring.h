@@ -0,0 +1,150 @@
+#ifndef PHIDGET_BRIDGE_RING_H
+#define PHIDGET_BRIDGE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * Bounded lock-free queue with preallocated storage. Any number of threads
+ * may push and pop concurrently, although the event queue only ever has a
+ * single consumer (the JS thread).
+ * Each cell carries a sequence number telling whether it is free for the
+ * producer of a given lap or holds data for the consumer, so a full queue
+ * makes push fail immediately instead of blocking the caller.
+ */
+template <typename T>
+class Ring
+{
+public:
+    explicit Ring(size_t requestedCapacity)
+    {
+        size_t capacity = 2;
+
+        while (capacity < requestedCapacity)
+        {
+            capacity <<= 1;
+        }
+
+        mask = capacity - 1;
+        cells = new Cell[capacity];
+
+        for (size_t i = 0; i < capacity; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    ~Ring()
+    {
+        delete[] cells;
+    }
+
+    bool push(const T &item)
+    {
+        Cell *cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        Cell *cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = cell->data;
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Approximate while producers are running, exact when they are idle.
+    size_t size() const
+    {
+        size_t head = enqueuePos.load(std::memory_order_relaxed);
+        size_t tail = dequeuePos.load(std::memory_order_relaxed);
+
+        return head > tail ? head - tail : 0;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Ring(const Ring&);
+    Ring& operator=(const Ring&);
+
+    // Producers and the consumer hammer different counters, keep them on
+    // separate cache lines.
+    char pad0[64];
+    Cell *cells;
+    size_t mask;
+    char pad1[64];
+    std::atomic<size_t> enqueuePos;
+    char pad2[64];
+    std::atomic<size_t> dequeuePos;
+    char pad3[64];
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef PHIDGET_BRIDGE_SAMPLEBUFFER_H
+#define PHIDGET_BRIDGE_SAMPLEBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <thread>
+
+// Doubles per record: sequence, handle, index, value, timestamp
+#define SAMPLE_RECORD_SIZE 5
+
+// Largest number of records enableSampleBuffer accepts, 640 MB of doubles
+#define MAX_SAMPLE_BUFFER_CAPACITY (1 << 24)
+
+/*
+ * Overwriting ring of data samples living in memory that JS reads directly
+ * through a Float64Array. Producers claim a slot with a single atomic add
+ * and publish it seqlock style: the sequence field is cleared while the
+ * record is written and set to the record number + 1 once it is complete,
+ * so a reader can tell finished, unfinished and overwritten records apart
+ * without any locking. header[0] holds the number of records claimed so
+ * far and is only a hint, the sequence fields are authoritative.
+ *
+ * Producers n and n + capacity share a record. Each record has an owner
+ * word, private to the addon, holding the newest record number that took
+ * the record and a busy bit, so only one producer writes a record at a
+ * time and a producer that finds a newer one already there drops its
+ * sample instead of publishing over it. Waiting for a busy record only
+ * happens when a producer is lapped while writing.
+ */
+class SampleBuffer
+{
+public:
+    SampleBuffer(double *header, double *records, size_t capacity)
+        : header(header), records(records), mask(capacity - 1), claimed(0),
+          owners(new std::atomic<uint64_t>[capacity])
+    {
+        for (size_t n = 0; n < capacity; n++)
+        {
+            owners[n].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~SampleBuffer()
+    {
+        delete[] owners;
+    }
+
+    // Returns false when the sample was dropped because a producer that
+    // claimed the record a lap later got there first
+    bool write(long handle, int index, double value, double timestamp)
+    {
+        uint64_t n = claimed.fetch_add(1, std::memory_order_relaxed);
+        std::atomic<uint64_t>& owner = owners[n & mask];
+        uint64_t mine = (n + 1) << 1;
+        uint64_t current = owner.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            if ((current >> 1) > n + 1)
+            {
+                return false;
+            }
+
+            if (current & 1)
+            {
+                std::this_thread::yield();
+                current = owner.load(std::memory_order_relaxed);
+            }
+            else if (owner.compare_exchange_weak(current, mine | 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+
+        volatile double *record = records + (n & mask) * SAMPLE_RECORD_SIZE;
+
+        record[0] = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+
+        record[1] = handle;
+        record[2] = index;
+        record[3] = value;
+        record[4] = timestamp;
+
+        std::atomic_thread_fence(std::memory_order_release);
+        record[0] = (double)(n + 1);
+
+        owner.store(mine, std::memory_order_release);
+
+        volatile double *head = header;
+
+        if (*head < (double)(n + 1))
+        {
+            *head = (double)(n + 1);
+        }
+
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    SampleBuffer(const SampleBuffer&);
+    SampleBuffer& operator=(const SampleBuffer&);
+
+    double *header;
+    double *records;
+    size_t mask;
+    std::atomic<uint64_t> claimed;
+    std::atomic<uint64_t> *owners;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef PHIDGET_BRIDGE_SIMULATOR_PHIDGET21_H
+#define PHIDGET_BRIDGE_SIMULATOR_PHIDGET21_H
+
+/*
+ * Stand-in for the parts of libphidget21 used by the addon. Built instead
+ * of linking the real library when binding.gyp is configured with
+ * -Dphidget_simulator=1, see simulator.cc for the environment variables
+ * controlling the simulated devices.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CCONV
+
+#define EPHIDGET_OK 0
+#define EPHIDGET_NOTFOUND 1
+#define EPHIDGET_NOMEMORY 2
+#define EPHIDGET_UNEXPECTED 3
+#define EPHIDGET_INVALIDARG 4
+#define EPHIDGET_NOTATTACHED 5
+#define EPHIDGET_TIMEOUT 13
+#define EPHIDGET_OUTOFBOUNDS 14
+
+typedef struct _CPhidget *CPhidgetHandle;
+typedef struct _CPhidgetBridge *CPhidgetBridgeHandle;
+typedef struct _CPhidgetManager *CPhidgetManagerHandle;
+
+// Only the class of the devices simulated
+typedef enum
+{
+    PHIDCLASS_BRIDGE = 23
+} CPhidget_DeviceClass;
+
+typedef enum
+{
+    PHIDGET_BRIDGE_GAIN_1 = 1,
+    PHIDGET_BRIDGE_GAIN_8,
+    PHIDGET_BRIDGE_GAIN_16,
+    PHIDGET_BRIDGE_GAIN_32,
+    PHIDGET_BRIDGE_GAIN_64,
+    PHIDGET_BRIDGE_GAIN_128,
+    PHIDGET_BRIDGE_GAIN_UNKNOWN
+} CPhidgetBridge_Gain;
+
+int CPhidget_open(CPhidgetHandle phid, int serialNumber);
+int CPhidget_close(CPhidgetHandle phid);
+int CPhidget_delete(CPhidgetHandle phid);
+int CPhidget_waitForAttachment(CPhidgetHandle phid, int milliseconds);
+int CPhidget_getDeviceName(CPhidgetHandle phid, const char **deviceName);
+int CPhidget_getSerialNumber(CPhidgetHandle phid, int *serialNumber);
+int CPhidget_getDeviceVersion(CPhidgetHandle phid, int *deviceVersion);
+int CPhidget_getDeviceStatus(CPhidgetHandle phid, int *deviceStatus);
+int CPhidget_getLibraryVersion(const char **libraryVersion);
+int CPhidget_getDeviceType(CPhidgetHandle phid, const char **deviceType);
+int CPhidget_getDeviceClass(CPhidgetHandle phid, CPhidget_DeviceClass *deviceClass);
+int CPhidget_getErrorDescription(int errorCode, const char **errorString);
+int CPhidget_set_OnAttach_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr);
+int CPhidget_set_OnDetach_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr);
+int CPhidget_set_OnError_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr, int errorCode, const char *errorString), void *userPtr);
+
+int CPhidgetManager_create(CPhidgetManagerHandle *phidm);
+int CPhidgetManager_open(CPhidgetManagerHandle phidm);
+int CPhidgetManager_close(CPhidgetManagerHandle phidm);
+int CPhidgetManager_delete(CPhidgetManagerHandle phidm);
+int CPhidgetManager_set_OnAttach_Handler(CPhidgetManagerHandle phidm, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr);
+int CPhidgetManager_set_OnDetach_Handler(CPhidgetManagerHandle phidm, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr);
+
+int CPhidgetBridge_create(CPhidgetBridgeHandle *phid);
+int CPhidgetBridge_getInputCount(CPhidgetBridgeHandle phid, int *count);
+int CPhidgetBridge_getBridgeValue(CPhidgetBridgeHandle phid, int index, double *value);
+int CPhidgetBridge_getBridgeMax(CPhidgetBridgeHandle phid, int index, double *max);
+int CPhidgetBridge_getBridgeMin(CPhidgetBridgeHandle phid, int index, double *min);
+int CPhidgetBridge_setEnabled(CPhidgetBridgeHandle phid, int index, int enabledState);
+int CPhidgetBridge_getEnabled(CPhidgetBridgeHandle phid, int index, int *enabledState);
+int CPhidgetBridge_getGain(CPhidgetBridgeHandle phid, int index, CPhidgetBridge_Gain *gain);
+int CPhidgetBridge_setGain(CPhidgetBridgeHandle phid, int index, CPhidgetBridge_Gain gain);
+int CPhidgetBridge_getDataRate(CPhidgetBridgeHandle phid, int *milliseconds);
+int CPhidgetBridge_setDataRate(CPhidgetBridgeHandle phid, int milliseconds);
+int CPhidgetBridge_getDataRateMax(CPhidgetBridgeHandle phid, int *max);
+int CPhidgetBridge_getDataRateMin(CPhidgetBridgeHandle phid, int *min);
+int CPhidgetBridge_set_OnBridgeData_Handler(CPhidgetBridgeHandle phid, int (CCONV *fptr)(CPhidgetBridgeHandle phid, void *userPtr, int index, double value), void *userPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,884 @@
+#include "phidget21.h"
+#include <uv.h>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Simulated PhidgetBridge devices. Every opened handle claims one of
+ * PHIDGET_SIM_DEVICES fake devices and gets a thread that attaches after
+ * PHIDGET_SIM_ATTACH_MS and then fires the bridge data handler for each
+ * enabled input once per data rate period, just like the real library.
+ * An opened manager reports every device as attached after the same
+ * delay.
+ *
+ * Environment variables, read when the first handle is created:
+ *   PHIDGET_SIM_DEVICES      number of devices available (default 1)
+ *   PHIDGET_SIM_INPUTS       inputs per device, at most 8 (default 4)
+ *   PHIDGET_SIM_SERIAL       serial number of the first device (default 100000)
+ *   PHIDGET_SIM_ATTACH_MS    delay between open and attach (default 100)
+ *   PHIDGET_SIM_INTERVAL_US  fixed period overriding the data rate, allows
+ *                            rates beyond the hardware limit (default 0)
+ *   PHIDGET_SIM_SIGNAL       "sine" for a noisy sine wave per input, or
+ *                            "clock" to send the monotonic time in
+ *                            milliseconds at which the sample was generated,
+ *                            used to measure latency (default "sine")
+ */
+
+#define SIM_MAX_INPUTS 8
+#define SIM_DATA_RATE_MIN 8
+#define SIM_DATA_RATE_MAX 1000
+
+#define EPHIDGET_UNKNOWNVAL 9
+
+enum Signals
+{
+    SINE,
+    CLOCK
+};
+
+class Config
+{
+public:
+    int devices;
+    int inputs;
+    int serialNumber;
+    int attachMilliseconds;
+    int intervalMicroseconds;
+    Signals signal;
+};
+
+struct _CPhidget
+{
+    uv_mutex_t mutex;
+    uv_cond_t wakeup;
+    uv_thread_t thread;
+    bool running;
+    std::atomic<bool> attached;
+    int slot;
+
+    int (CCONV *attachHandler)(CPhidgetHandle phid, void *userPtr);
+    void *attachPtr;
+    int (CCONV *detachHandler)(CPhidgetHandle phid, void *userPtr);
+    void *detachPtr;
+    int (CCONV *errorHandler)(CPhidgetHandle phid, void *userPtr, int errorCode, const char *errorString);
+    void *errorPtr;
+    int (CCONV *dataHandler)(CPhidgetBridgeHandle phid, void *userPtr, int index, double value);
+    void *dataPtr;
+
+    std::atomic<int> dataRate;
+    std::atomic<int> enabled[SIM_MAX_INPUTS];
+    std::atomic<int> gain[SIM_MAX_INPUTS];
+    double value[SIM_MAX_INPUTS];
+    bool hasValue[SIM_MAX_INPUTS];
+    unsigned int noise;
+};
+
+struct _CPhidgetManager
+{
+    uv_mutex_t mutex;
+    uv_cond_t wakeup;
+    uv_thread_t thread;
+    bool running;
+
+    int (CCONV *attachHandler)(CPhidgetHandle phid, void *userPtr);
+    void *attachPtr;
+    int (CCONV *detachHandler)(CPhidgetHandle phid, void *userPtr);
+    void *detachPtr;
+
+    // What the manager handlers are passed, one per device. Attached but
+    // never opened, so they only answer the device information calls.
+    std::vector<CPhidgetHandle> devices;
+};
+
+static Config config;
+static uv_once_t configOnce = UV_ONCE_INIT;
+static uv_mutex_t slotsMutex;
+static std::vector<bool> slots;
+
+static const char *errorDescriptions[] = {
+    "Function completed successfully.",
+    "A Phidget matching the type and or serial number could not be found.",
+    "Memory could not be allocated.",
+    "Unexpected Error.  Contact Phidgets Inc. for support.",
+    "Invalid argument passed to function.",
+    "Phidget not physically attached.",
+    "", "", "",
+    "The value is unknown.",
+    "", "", "",
+    "Time exceeded.",
+    "Index out of Bounds."
+};
+
+static int readEnvironment(const char *name, int defaultValue)
+{
+    const char *value = getenv(name);
+
+    return value != NULL ? atoi(value) : defaultValue;
+}
+
+static void loadConfig()
+{
+    const char *signal = getenv("PHIDGET_SIM_SIGNAL");
+
+    config.devices = readEnvironment("PHIDGET_SIM_DEVICES", 1);
+    config.inputs = readEnvironment("PHIDGET_SIM_INPUTS", 4);
+    config.serialNumber = readEnvironment("PHIDGET_SIM_SERIAL", 100000);
+    config.attachMilliseconds = readEnvironment("PHIDGET_SIM_ATTACH_MS", 100);
+    config.intervalMicroseconds = readEnvironment("PHIDGET_SIM_INTERVAL_US", 0);
+    config.signal = signal != NULL && strcmp(signal, "clock") == 0 ? CLOCK : SINE;
+
+    if (config.inputs > SIM_MAX_INPUTS)
+    {
+        config.inputs = SIM_MAX_INPUTS;
+    }
+
+    uv_mutex_init(&slotsMutex);
+    slots.resize(config.devices, false);
+}
+
+static int claimSlot(int serialNumber)
+{
+    int slot = -1;
+
+    uv_mutex_lock(&slotsMutex);
+
+    for (int n = 0; n < config.devices; n++)
+    {
+        if (!slots[n] && (serialNumber == -1 || serialNumber == config.serialNumber + n))
+        {
+            slots[n] = true;
+            slot = n;
+            break;
+        }
+    }
+
+    uv_mutex_unlock(&slotsMutex);
+
+    return slot;
+}
+
+static void releaseSlot(int slot)
+{
+    uv_mutex_lock(&slotsMutex);
+    slots[slot] = false;
+    uv_mutex_unlock(&slotsMutex);
+}
+
+static double gainFactor(int gain)
+{
+    static const double factors[] = { 1, 1, 8, 16, 32, 64, 128, 1 };
+
+    return factors[gain & 7];
+}
+
+static double generate(CPhidgetHandle phid, int index, uint64_t now)
+{
+    if (config.signal == CLOCK)
+    {
+        return now / 1e6;
+    }
+
+    phid->noise = phid->noise * 1103515245 + 12345;
+
+    double seconds = now / 1e9;
+    double noise = ((phid->noise >> 16) & 0x7fff) / 32768.0 - 0.5;
+
+    return 0.5 * sin(2 * M_PI * seconds + index) + 0.001 * noise;
+}
+
+// Sleeps until the deadline or until the device is closed, returns false
+// when it should stop. Called with the device mutex held.
+static bool waitUntil(CPhidgetHandle phid, uint64_t deadline)
+{
+    uint64_t now;
+
+    while (phid->running && (now = uv_hrtime()) < deadline)
+    {
+        uv_cond_timedwait(&phid->wakeup, &phid->mutex, deadline - now);
+    }
+
+    return phid->running;
+}
+
+static void deviceThread(void *arg)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)arg;
+    uint64_t next = uv_hrtime() + (uint64_t)config.attachMilliseconds * 1000000;
+
+    uv_mutex_lock(&phid->mutex);
+
+    if (!waitUntil(phid, next))
+    {
+        uv_mutex_unlock(&phid->mutex);
+        return;
+    }
+
+    phid->attached = true;
+    uv_cond_broadcast(&phid->wakeup);
+    uv_mutex_unlock(&phid->mutex);
+
+    if (phid->attachHandler != NULL)
+    {
+        phid->attachHandler(phid, phid->attachPtr);
+    }
+
+    next = uv_hrtime();
+
+    for (;;)
+    {
+        uint64_t interval = config.intervalMicroseconds > 0 ? (uint64_t)config.intervalMicroseconds * 1000 : (uint64_t)phid->dataRate.load() * 1000000;
+        uint64_t now = uv_hrtime();
+
+        // Start over rather than bursting if we have fallen far behind
+        next = now > next + 100 * interval ? now + interval : next + interval;
+
+        uv_mutex_lock(&phid->mutex);
+
+        if (!waitUntil(phid, next))
+        {
+            uv_mutex_unlock(&phid->mutex);
+            break;
+        }
+
+        uv_mutex_unlock(&phid->mutex);
+
+        for (int index = 0; index < config.inputs; index++)
+        {
+            if (!phid->enabled[index].load())
+            {
+                continue;
+            }
+
+            double value = generate(phid, index, uv_hrtime());
+
+            uv_mutex_lock(&phid->mutex);
+            phid->value[index] = value;
+            phid->hasValue[index] = true;
+            uv_mutex_unlock(&phid->mutex);
+
+            if (phid->dataHandler != NULL)
+            {
+                phid->dataHandler((CPhidgetBridgeHandle)phid, phid->dataPtr, index, value);
+            }
+        }
+    }
+
+    phid->attached = false;
+
+    if (phid->detachHandler != NULL)
+    {
+        phid->detachHandler(phid, phid->detachPtr);
+    }
+}
+
+static int attachedDevice(CPhidgetHandle phid, int index)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    if (!phid->attached)
+    {
+        return EPHIDGET_NOTATTACHED;
+    }
+
+    if (index < 0 || index >= config.inputs)
+    {
+        return EPHIDGET_OUTOFBOUNDS;
+    }
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetBridge_create(CPhidgetBridgeHandle *handle)
+{
+    uv_once(&configOnce, loadConfig);
+
+    CPhidgetHandle phid = new _CPhidget();
+
+    uv_mutex_init(&phid->mutex);
+    uv_cond_init(&phid->wakeup);
+    phid->slot = -1;
+    phid->dataRate = SIM_DATA_RATE_MIN;
+    phid->noise = (unsigned int)(uintptr_t)phid;
+
+    for (int index = 0; index < SIM_MAX_INPUTS; index++)
+    {
+        phid->enabled[index] = 0;
+        phid->gain[index] = PHIDGET_BRIDGE_GAIN_1;
+    }
+
+    *handle = (CPhidgetBridgeHandle)phid;
+
+    return EPHIDGET_OK;
+}
+
+static void managerThread(void *arg)
+{
+    CPhidgetManagerHandle phidm = (CPhidgetManagerHandle)arg;
+    uint64_t deadline = uv_hrtime() + (uint64_t)config.attachMilliseconds * 1000000;
+    uint64_t now;
+
+    uv_mutex_lock(&phidm->mutex);
+
+    while (phidm->running && (now = uv_hrtime()) < deadline)
+    {
+        uv_cond_timedwait(&phidm->wakeup, &phidm->mutex, deadline - now);
+    }
+
+    uv_mutex_unlock(&phidm->mutex);
+
+    for (size_t n = 0; n < phidm->devices.size() && phidm->running; n++)
+    {
+        if (phidm->attachHandler != NULL)
+        {
+            phidm->attachHandler(phidm->devices[n], phidm->attachPtr);
+        }
+    }
+}
+
+int CPhidgetManager_create(CPhidgetManagerHandle *handle)
+{
+    uv_once(&configOnce, loadConfig);
+
+    CPhidgetManagerHandle phidm = new _CPhidgetManager();
+
+    uv_mutex_init(&phidm->mutex);
+    uv_cond_init(&phidm->wakeup);
+
+    for (int n = 0; n < config.devices; n++)
+    {
+        CPhidgetHandle phid;
+
+        CPhidgetBridge_create((CPhidgetBridgeHandle*)&phid);
+        phid->slot = n;
+        phid->attached = true;
+        phidm->devices.push_back(phid);
+    }
+
+    *handle = phidm;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetManager_open(CPhidgetManagerHandle phidm)
+{
+    if (phidm == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    if (phidm->running)
+    {
+        return EPHIDGET_UNEXPECTED;
+    }
+
+    phidm->running = true;
+    uv_thread_create(&phidm->thread, managerThread, phidm);
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetManager_close(CPhidgetManagerHandle phidm)
+{
+    if (phidm == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    if (!phidm->running)
+    {
+        return EPHIDGET_OK;
+    }
+
+    uv_mutex_lock(&phidm->mutex);
+    phidm->running = false;
+    uv_cond_broadcast(&phidm->wakeup);
+    uv_mutex_unlock(&phidm->mutex);
+
+    uv_thread_join(&phidm->thread);
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetManager_delete(CPhidgetManagerHandle phidm)
+{
+    if (phidm == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    CPhidgetManager_close(phidm);
+
+    // Never opened, so there is no thread or slot to release
+    for (size_t n = 0; n < phidm->devices.size(); n++)
+    {
+        uv_cond_destroy(&phidm->devices[n]->wakeup);
+        uv_mutex_destroy(&phidm->devices[n]->mutex);
+        delete phidm->devices[n];
+    }
+
+    uv_cond_destroy(&phidm->wakeup);
+    uv_mutex_destroy(&phidm->mutex);
+    delete phidm;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetManager_set_OnAttach_Handler(CPhidgetManagerHandle phidm, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr)
+{
+    if (phidm == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phidm->attachHandler = fptr;
+    phidm->attachPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetManager_set_OnDetach_Handler(CPhidgetManagerHandle phidm, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr)
+{
+    if (phidm == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phidm->detachHandler = fptr;
+    phidm->detachPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_open(CPhidgetHandle phid, int serialNumber)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    if (phid->slot != -1)
+    {
+        return EPHIDGET_UNEXPECTED;
+    }
+
+    phid->slot = claimSlot(serialNumber);
+
+    // The real library keeps looking for the device in the background, a
+    // device that does not exist simply never attaches.
+    if (phid->slot == -1)
+    {
+        return EPHIDGET_OK;
+    }
+
+    phid->running = true;
+    uv_thread_create(&phid->thread, deviceThread, phid);
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_close(CPhidgetHandle phid)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    if (phid->slot == -1)
+    {
+        return EPHIDGET_OK;
+    }
+
+    uv_mutex_lock(&phid->mutex);
+    phid->running = false;
+    uv_cond_broadcast(&phid->wakeup);
+    uv_mutex_unlock(&phid->mutex);
+
+    uv_thread_join(&phid->thread);
+
+    releaseSlot(phid->slot);
+    phid->slot = -1;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_delete(CPhidgetHandle phid)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    CPhidget_close(phid);
+
+    uv_cond_destroy(&phid->wakeup);
+    uv_mutex_destroy(&phid->mutex);
+    delete phid;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_waitForAttachment(CPhidgetHandle phid, int milliseconds)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    uint64_t deadline = uv_hrtime() + (uint64_t)milliseconds * 1000000;
+    uint64_t now;
+
+    uv_mutex_lock(&phid->mutex);
+
+    while (!phid->attached)
+    {
+        now = uv_hrtime();
+
+        if (milliseconds == 0)
+        {
+            uv_cond_wait(&phid->wakeup, &phid->mutex);
+        }
+        else if (now >= deadline || uv_cond_timedwait(&phid->wakeup, &phid->mutex, deadline - now) != 0)
+        {
+            if (!phid->attached)
+            {
+                uv_mutex_unlock(&phid->mutex);
+                return EPHIDGET_TIMEOUT;
+            }
+        }
+    }
+
+    uv_mutex_unlock(&phid->mutex);
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_getDeviceName(CPhidgetHandle phid, const char **deviceName)
+{
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *deviceName = "Phidget Bridge 4-input (simulated)";
+    }
+
+    return errorCode;
+}
+
+int CPhidget_getSerialNumber(CPhidgetHandle phid, int *serialNumber)
+{
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *serialNumber = config.serialNumber + phid->slot;
+    }
+
+    return errorCode;
+}
+
+int CPhidget_getDeviceClass(CPhidgetHandle phid, CPhidget_DeviceClass *deviceClass)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    *deviceClass = PHIDCLASS_BRIDGE;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_getDeviceVersion(CPhidgetHandle phid, int *deviceVersion)
+{
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *deviceVersion = 102;
+    }
+
+    return errorCode;
+}
+
+int CPhidget_getDeviceStatus(CPhidgetHandle phid, int *deviceStatus)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    *deviceStatus = phid->attached ? 1 : 0;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_getLibraryVersion(const char **libraryVersion)
+{
+    *libraryVersion = "Phidget21 simulator - Version 2.1.8";
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_getDeviceType(CPhidgetHandle phid, const char **deviceType)
+{
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *deviceType = "PhidgetBridge";
+    }
+
+    return errorCode;
+}
+
+int CPhidget_getErrorDescription(int errorCode, const char **errorString)
+{
+    if (errorCode < 0 || errorCode >= (int)(sizeof(errorDescriptions) / sizeof(errorDescriptions[0])) || errorDescriptions[errorCode][0] == 0)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    *errorString = errorDescriptions[errorCode];
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_set_OnAttach_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->attachHandler = fptr;
+    phid->attachPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_set_OnDetach_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr), void *userPtr)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->detachHandler = fptr;
+    phid->detachPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidget_set_OnError_Handler(CPhidgetHandle phid, int (CCONV *fptr)(CPhidgetHandle phid, void *userPtr, int errorCode, const char *errorString), void *userPtr)
+{
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->errorHandler = fptr;
+    phid->errorPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetBridge_getInputCount(CPhidgetBridgeHandle handle, int *count)
+{
+    int errorCode = attachedDevice((CPhidgetHandle)handle, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *count = config.inputs;
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getBridgeValue(CPhidgetBridgeHandle handle, int index, double *value)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode != EPHIDGET_OK)
+    {
+        return errorCode;
+    }
+
+    uv_mutex_lock(&phid->mutex);
+
+    if (!phid->enabled[index].load() || !phid->hasValue[index])
+    {
+        errorCode = EPHIDGET_UNKNOWNVAL;
+    }
+    else
+    {
+        *value = phid->value[index];
+    }
+
+    uv_mutex_unlock(&phid->mutex);
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getBridgeMax(CPhidgetBridgeHandle handle, int index, double *max)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *max = 1000 / gainFactor(phid->gain[index].load());
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getBridgeMin(CPhidgetBridgeHandle handle, int index, double *min)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *min = -1000 / gainFactor(phid->gain[index].load());
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_setEnabled(CPhidgetBridgeHandle handle, int index, int enabledState)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        phid->enabled[index] = enabledState ? 1 : 0;
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getEnabled(CPhidgetBridgeHandle handle, int index, int *enabledState)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *enabledState = phid->enabled[index].load();
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getGain(CPhidgetBridgeHandle handle, int index, CPhidgetBridge_Gain *gain)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *gain = (CPhidgetBridge_Gain)phid->gain[index].load();
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_setGain(CPhidgetBridgeHandle handle, int index, CPhidgetBridge_Gain gain)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, index);
+
+    if (errorCode != EPHIDGET_OK)
+    {
+        return errorCode;
+    }
+
+    if (gain < PHIDGET_BRIDGE_GAIN_1 || gain > PHIDGET_BRIDGE_GAIN_128)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->gain[index] = gain;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetBridge_getDataRate(CPhidgetBridgeHandle handle, int *milliseconds)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *milliseconds = phid->dataRate.load();
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_setDataRate(CPhidgetBridgeHandle handle, int milliseconds)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+    int errorCode = attachedDevice(phid, 0);
+
+    if (errorCode != EPHIDGET_OK)
+    {
+        return errorCode;
+    }
+
+    if (milliseconds < SIM_DATA_RATE_MIN || milliseconds > SIM_DATA_RATE_MAX || milliseconds % SIM_DATA_RATE_MIN != 0)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->dataRate = milliseconds;
+
+    return EPHIDGET_OK;
+}
+
+int CPhidgetBridge_getDataRateMax(CPhidgetBridgeHandle handle, int *max)
+{
+    int errorCode = attachedDevice((CPhidgetHandle)handle, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *max = SIM_DATA_RATE_MAX;
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_getDataRateMin(CPhidgetBridgeHandle handle, int *min)
+{
+    int errorCode = attachedDevice((CPhidgetHandle)handle, 0);
+
+    if (errorCode == EPHIDGET_OK)
+    {
+        *min = SIM_DATA_RATE_MIN;
+    }
+
+    return errorCode;
+}
+
+int CPhidgetBridge_set_OnBridgeData_Handler(CPhidgetBridgeHandle handle, int (CCONV *fptr)(CPhidgetBridgeHandle phid, void *userPtr, int index, double value), void *userPtr)
+{
+    CPhidgetHandle phid = (CPhidgetHandle)handle;
+
+    if (phid == NULL)
+    {
+        return EPHIDGET_INVALIDARG;
+    }
+
+    phid->dataHandler = fptr;
+    phid->dataPtr = userPtr;
+
+    return EPHIDGET_OK;
+}
@@ -0,0 +1,115 @@
+#ifndef PHIDGET_BRIDGE_STATS_H
+#define PHIDGET_BRIDGE_STATS_H
+
+#include <cmath>
+#include <stdint.h>
+
+// Values per channel returned by getChannelStats, in this order
+enum ChannelStatsFields
+{
+    CHANNEL_COUNT,
+    CHANNEL_MEAN,
+    CHANNEL_VARIANCE,
+    CHANNEL_MIN,
+    CHANNEL_MAX,
+    CHANNEL_EWMA_MEAN,
+    CHANNEL_EWMA_VARIANCE,
+    CHANNEL_SINCE,
+    CHANNEL_STATS_FIELDS
+};
+
+/*
+ * Running statistics of one channel since the last reset. Mean and
+ * variance are updated with Welford's method, which stays accurate for
+ * values far from zero, unlike keeping sums of squares. With a smoothing
+ * factor the exponentially weighted mean and variance are kept as well.
+ */
+class RunningStats
+{
+public:
+    RunningStats() : active(false)
+    {
+    }
+
+    void configure(bool enable, double smoothing, uint64_t now)
+    {
+        active = enable;
+        alpha = smoothing;
+        reset(now);
+    }
+
+    bool enabled() const
+    {
+        return active;
+    }
+
+    void reset(uint64_t now)
+    {
+        count = 0;
+        mean = 0;
+        m2 = 0;
+        since = now;
+    }
+
+    void add(double value)
+    {
+        double delta = value - mean;
+
+        count++;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+
+        if (count == 1)
+        {
+            min = max = ewmaMean = value;
+            ewmaVariance = 0;
+            return;
+        }
+
+        if (value < min)
+        {
+            min = value;
+        }
+
+        if (value > max)
+        {
+            max = value;
+        }
+
+        if (alpha > 0)
+        {
+            double difference = value - ewmaMean;
+            double increment = alpha * difference;
+
+            ewmaMean += increment;
+            ewmaVariance = (1 - alpha) * (ewmaVariance + difference * increment);
+        }
+    }
+
+    // Writes CHANNEL_STATS_FIELDS values, NaN where there is no value yet
+    void read(double *out) const
+    {
+        out[CHANNEL_COUNT] = (double)count;
+        out[CHANNEL_MEAN] = count > 0 ? mean : NAN;
+        out[CHANNEL_VARIANCE] = count > 1 ? m2 / (count - 1) : NAN;
+        out[CHANNEL_MIN] = count > 0 ? min : NAN;
+        out[CHANNEL_MAX] = count > 0 ? max : NAN;
+        out[CHANNEL_EWMA_MEAN] = count > 0 && alpha > 0 ? ewmaMean : NAN;
+        out[CHANNEL_EWMA_VARIANCE] = count > 0 && alpha > 0 ? ewmaVariance : NAN;
+        out[CHANNEL_SINCE] = since / 1e6;
+    }
+
+private:
+    bool active;
+    double alpha;
+    uint64_t count;
+    double mean;
+    double m2;
+    double min;
+    double max;
+    double ewmaMean;
+    double ewmaVariance;
+    uint64_t since;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PHIDGET_BRIDGE_TRACE_H
+#define PHIDGET_BRIDGE_TRACE_H
+
+/*
+ * USDT probes in the event path, provider phidget_bridge. Compiled in
+ * with node-gyp rebuild -- -Dphidget_tracing=1, which needs <sys/sdt.h>
+ * (systemtap-sdt-dev). An idle probe is a single nop, so they can stay in
+ * production builds and be attached to with perf or bpftrace:
+ *
+ *   bpftrace -e 'usdt:build/Release/binding.node:phidget_bridge:dispatch { @[arg2] = hist(arg3); }'
+ *
+ *   enqueue(handle, index, event, depth)   library thread queued an event,
+ *                                          depth of the queue it went to
+ *   wakeup(control)                        the async callback started
+ *   drain_start(events, devices)           events the drain will deliver
+ *   dispatch(handle, index, event, ns)     an event goes to JS, ns since
+ *                                          it was queued
+ *   drain_end(events, ns)                  the drain is done
+ *
+ * Events are numbered as in baton.h, index is -1 for events of the whole
+ * device.
+ */
+#ifdef PHIDGET_TRACING
+
+#include <sys/sdt.h>
+
+#define TRACE_ENQUEUE(handle, index, event, depth) DTRACE_PROBE4(phidget_bridge, enqueue, handle, index, event, depth)
+#define TRACE_WAKEUP(control) DTRACE_PROBE1(phidget_bridge, wakeup, control)
+#define TRACE_DRAIN_START(events, devices) DTRACE_PROBE2(phidget_bridge, drain_start, events, devices)
+#define TRACE_DISPATCH(handle, index, event, latency) DTRACE_PROBE4(phidget_bridge, dispatch, handle, index, event, latency)
+#define TRACE_DRAIN_END(events, duration) DTRACE_PROBE2(phidget_bridge, drain_end, events, duration)
+
+#else
+
+#define TRACE_ENQUEUE(handle, index, event, depth)
+#define TRACE_WAKEUP(control)
+#define TRACE_DRAIN_START(events, devices)
+#define TRACE_DISPATCH(handle, index, event, latency)
+#define TRACE_DRAIN_END(events, duration)
+
+#endif
+
+#endif
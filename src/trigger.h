@@ -0,0 +1,167 @@
+#ifndef PHIDGET_BRIDGE_TRIGGER_H
+#define PHIDGET_BRIDGE_TRIGGER_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#define MAX_TRIGGERS 4
+
+enum TriggerEdges
+{
+    EDGE_RISING = 1,
+    EDGE_FALLING = 2,
+    EDGE_BOTH = 3
+};
+
+// A confirmed crossing, timestamp and value are those of its first sample
+class Crossing
+{
+public:
+    int trigger;
+    bool rising;
+    uint64_t timestamp;
+    double value;
+};
+
+/*
+ * Level trigger with a hysteresis band. The channel is high once it
+ * reaches the upper level and low once it reaches the lower one, in
+ * between it keeps its state, so noise around a limit fires once. A
+ * rising trigger fires at the threshold and re-arms hysteresis below it,
+ * a falling trigger the other way around. With a dwell time the new
+ * level has to hold that long before the crossing counts.
+ */
+class Trigger
+{
+public:
+    Trigger() : edges(0)
+    {
+    }
+
+    void configure(double threshold, double hysteresis, uint64_t dwellNs, int triggerEdges)
+    {
+        edges = triggerEdges;
+        upper = edges == EDGE_FALLING ? threshold + hysteresis : threshold;
+        lower = edges == EDGE_FALLING ? threshold : threshold - hysteresis;
+        dwell = dwellNs;
+        state = STATE_UNKNOWN;
+        pending = false;
+    }
+
+    void clear()
+    {
+        edges = 0;
+    }
+
+    bool enabled() const
+    {
+        return edges != 0;
+    }
+
+    bool evaluate(double value, uint64_t timestamp, Crossing &crossing)
+    {
+        if (state == STATE_UNKNOWN)
+        {
+            state = value >= upper ? STATE_HIGH : value <= lower ? STATE_LOW : STATE_UNKNOWN;
+            return false;
+        }
+
+        bool high = state == STATE_HIGH;
+
+        if (high ? value > lower : value < upper)
+        {
+            pending = false;
+            return false;
+        }
+
+        if (!pending)
+        {
+            pending = true;
+            since = timestamp;
+            sinceValue = value;
+        }
+
+        if (timestamp - since < dwell)
+        {
+            return false;
+        }
+
+        pending = false;
+        state = high ? STATE_LOW : STATE_HIGH;
+
+        if (!(edges & (high ? EDGE_FALLING : EDGE_RISING)))
+        {
+            return false;
+        }
+
+        crossing.rising = !high;
+        crossing.timestamp = since;
+        crossing.value = sinceValue;
+
+        return true;
+    }
+
+private:
+    enum States
+    {
+        STATE_UNKNOWN,
+        STATE_LOW,
+        STATE_HIGH
+    };
+
+    int edges;
+    double upper;
+    double lower;
+    uint64_t dwell;
+    States state;
+    bool pending;
+    uint64_t since;
+    double sinceValue;
+};
+
+// The triggers of one channel
+class TriggerSet
+{
+public:
+    TriggerSet() : count(0)
+    {
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Returns the new trigger, NULL when all are taken
+    Trigger *add()
+    {
+        return count < MAX_TRIGGERS ? &triggers[count++] : NULL;
+    }
+
+    bool enabled() const
+    {
+        return count > 0;
+    }
+
+    // Fills crossings and returns how many fired
+    int evaluate(double value, uint64_t timestamp, Crossing *crossings)
+    {
+        int fired = 0;
+
+        for (int n = 0; n < count; n++)
+        {
+            if (triggers[n].evaluate(value, timestamp, crossings[fired]))
+            {
+                crossings[fired++].trigger = n;
+            }
+        }
+
+        return fired;
+    }
+
+private:
+    Trigger triggers[MAX_TRIGGERS];
+    int count;
+};
+
+#endif
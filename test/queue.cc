@@ -0,0 +1,95 @@
+// Control events have to get through while every device floods its ring:
+//
+//   make test
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "queue.h"
+
+// The sizes the bridge uses, see instance.h and device.h
+#define EVENT_QUEUE_CAPACITY 16384
+#define CONTROL_QUEUE_CAPACITY 1024
+#define DEVICE_QUEUE_CAPACITY 4096
+
+// More devices than the shared data pool can fill the rings of
+#define DEVICES 8
+
+static void check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "queue: %s\n", message);
+        exit(1);
+    }
+}
+
+int main()
+{
+    EventQueue queue(EVENT_QUEUE_CAPACITY, CONTROL_QUEUE_CAPACITY, DEVICE_QUEUE_CAPACITY);
+    std::vector<Ring<Baton*>*> rings;
+    size_t queued = 0;
+
+    for (int device = 0; device < DEVICES; device++)
+    {
+        Ring<Baton*> *ring = new Ring<Baton*>(DEVICE_QUEUE_CAPACITY);
+
+        rings.push_back(ring);
+
+        while (!queue.full(*ring))
+        {
+            Baton *baton = queue.acquire(device + 1, DATA);
+
+            if (baton == NULL)
+            {
+                break;
+            }
+
+            queue.push(baton, *ring);
+            queued++;
+        }
+    }
+
+    check(queue.acquire(1, DATA) == NULL, "data pool not exhausted by the rings");
+    check(queued == queue.pool.capacity(), "data pool not fully queued");
+
+    Events events[] = { ATTACH, DETACH, ERROR, TARE, TRIGGER };
+
+    for (int n = 0; n < 5; n++)
+    {
+        Baton *baton = queue.acquire(DEVICES, events[n]);
+
+        check(baton != NULL, "no baton for a control event");
+        queue.push(baton, *rings[DEVICES - 1]);
+    }
+
+    for (int n = 0; n < 5; n++)
+    {
+        Baton *baton;
+
+        check(queue.control.pop(baton), "control event lost");
+        check(baton->event == events[n] && baton->handle == DEVICES, "wrong control event");
+        queue.release(baton);
+    }
+
+    check(queue.droppedControlCount() == 0, "control event dropped");
+
+    for (size_t device = 0; device < rings.size(); device++)
+    {
+        Baton *baton;
+
+        while (rings[device]->pop(baton))
+        {
+            check(baton->event == DATA, "data ring holds a control event");
+            queue.release(baton);
+        }
+
+        delete rings[device];
+    }
+
+    check(queue.pool.inUse() == 0 && queue.controlPool.inUse() == 0, "batons returned to the wrong pool");
+
+    printf("queue: %lu data events queued, control events delivered\n", (unsigned long)queued);
+
+    return 0;
+}
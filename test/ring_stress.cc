@@ -0,0 +1,150 @@
+// Several producers and consumers hammering a small ring:
+//
+//   make test
+//
+// Each item carries its producer and a per-producer sequence number. A
+// consumer has to see the items of every producer in increasing order,
+// and all consumers together every item exactly once.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "ring.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 3
+#define ITEMS 1000000
+
+// Small, so the ring keeps wrapping and running full and empty
+#define RING_CAPACITY 64
+
+static Ring<uint64_t> ring(RING_CAPACITY);
+static std::atomic<int> producing(PRODUCERS);
+static std::vector<unsigned char> seen[PRODUCERS];
+static std::atomic<unsigned long> failures(0);
+
+static void fail(const char *message, uint64_t producer, uint64_t sequence)
+{
+    if (failures.fetch_add(1) < 10)
+    {
+        fprintf(stderr, "ring_stress: %s, producer %lu item %lu\n", message, (unsigned long)producer, (unsigned long)sequence);
+    }
+}
+
+static void produce(uint64_t producer)
+{
+    for (uint64_t sequence = 0; sequence < ITEMS; sequence++)
+    {
+        while (!ring.push(producer << 32 | sequence))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    producing.fetch_sub(1);
+}
+
+static void consume()
+{
+    int64_t last[PRODUCERS];
+    uint64_t item;
+
+    for (int n = 0; n < PRODUCERS; n++)
+    {
+        last[n] = -1;
+    }
+
+    for (;;)
+    {
+        if (!ring.pop(item))
+        {
+            if (producing.load() != 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Everything pushed is visible once the producers are done
+            if (!ring.pop(item))
+            {
+                return;
+            }
+        }
+
+        uint64_t producer = item >> 32;
+        uint64_t sequence = item & 0xffffffff;
+
+        if (producer >= PRODUCERS || sequence >= ITEMS)
+        {
+            fail("corrupt item", producer, sequence);
+            continue;
+        }
+
+        if ((int64_t)sequence <= last[producer])
+        {
+            fail("out of order", producer, sequence);
+        }
+
+        last[producer] = sequence;
+
+        // Each consumer writes distinct items, so plain bytes are enough
+        if (seen[producer][sequence]++ != 0)
+        {
+            fail("duplicated", producer, sequence);
+        }
+    }
+}
+
+int main()
+{
+    std::vector<std::thread> threads;
+
+    for (int n = 0; n < PRODUCERS; n++)
+    {
+        seen[n].assign(ITEMS, 0);
+    }
+
+    for (int n = 0; n < CONSUMERS; n++)
+    {
+        threads.push_back(std::thread(consume));
+    }
+
+    for (int n = 0; n < PRODUCERS; n++)
+    {
+        threads.push_back(std::thread(produce, (uint64_t)n));
+    }
+
+    for (size_t n = 0; n < threads.size(); n++)
+    {
+        threads[n].join();
+    }
+
+    for (uint64_t producer = 0; producer < PRODUCERS; producer++)
+    {
+        for (uint64_t sequence = 0; sequence < ITEMS; sequence++)
+        {
+            if (seen[producer][sequence] == 0)
+            {
+                fail("lost", producer, sequence);
+            }
+        }
+    }
+
+    if (ring.size() != 0)
+    {
+        fail("ring not empty", 0, ring.size());
+    }
+
+    if (failures.load() != 0)
+    {
+        fprintf(stderr, "ring_stress: %lu failures\n", failures.load());
+        return 1;
+    }
+
+    printf("ring_stress: %d producers, %d consumers, %d items each\n", PRODUCERS, CONSUMERS, ITEMS);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Several producers lapping each other in the smallest sample buffer while
+// a reader polls it the way SampleReader in lib/index.js does:
+//
+//   make test
+//
+// Every field of a record is derived from the same sample, so a record the
+// reader accepts has to be consistent, however the producers interleave.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "samplebuffer.h"
+
+#define PRODUCERS 4
+#define SAMPLES 1000000
+
+// The smallest capacity enableSampleBuffer accepts, so producers collide
+#define BUFFER_CAPACITY 2
+
+static double header[1];
+static double records[BUFFER_CAPACITY * SAMPLE_RECORD_SIZE];
+static SampleBuffer buffer(header, records, BUFFER_CAPACITY);
+static std::atomic<int> producing(PRODUCERS);
+static std::atomic<unsigned long> dropped(0);
+
+static void produce(long producer)
+{
+    for (long sample = 0; sample < SAMPLES; sample++)
+    {
+        if (!buffer.write(producer, (int)(sample & 0xff), (double)sample, (double)(producer * SAMPLES + sample)))
+        {
+            dropped.fetch_add(1);
+        }
+    }
+
+    producing.fetch_sub(1);
+}
+
+int main()
+{
+    std::vector<std::thread> threads;
+    volatile double *head = header;
+    volatile double *fields = records;
+    unsigned long accepted = 0, lost = 0, failures = 0;
+    double next = 0;
+
+    for (long n = 0; n < PRODUCERS; n++)
+    {
+        threads.push_back(std::thread(produce, n));
+    }
+
+    while (producing.load() != 0)
+    {
+        double last = *head;
+
+        if (last - next > BUFFER_CAPACITY)
+        {
+            lost += (unsigned long)(last - next - BUFFER_CAPACITY);
+            next = last - BUFFER_CAPACITY;
+        }
+
+        while (next < last)
+        {
+            volatile double *record = fields + ((uint64_t)next % BUFFER_CAPACITY) * SAMPLE_RECORD_SIZE;
+            double sequence = record[0];
+
+            if (sequence < next + 1)
+            {
+                break;
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            double handle = record[1];
+            double index = record[2];
+            double value = record[3];
+            double timestamp = record[4];
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (sequence != next + 1 || record[0] != sequence)
+            {
+                lost++;
+            }
+            else if (timestamp != handle * SAMPLES + value || index != (double)((long)value & 0xff))
+            {
+                if (failures++ < 10)
+                {
+                    fprintf(stderr, "sample_stress: torn record %.0f: %.0f %.0f %.0f %.0f\n", sequence, handle, index, value, timestamp);
+                }
+            }
+            else
+            {
+                accepted++;
+            }
+
+            next++;
+        }
+    }
+
+    for (size_t n = 0; n < threads.size(); n++)
+    {
+        threads[n].join();
+    }
+
+    if (failures != 0)
+    {
+        fprintf(stderr, "sample_stress: %lu torn records\n", failures);
+        return 1;
+    }
+
+    printf("sample_stress: %d producers, %d samples each, %lu read, %lu lost, %lu dropped\n", PRODUCERS, SAMPLES, accepted, lost, dropped.load());
+
+    return 0;
+}